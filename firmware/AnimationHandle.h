@@ -0,0 +1,13 @@
+#pragma once
+
+#include <memory>
+#include "IAnimation.h"
+
+/// @brief Destroys an animation, and hands its memory back to the animation pool
+struct AnimationDeleter
+{
+    void operator()(IAnimation *animation) const;
+};
+
+/// @brief Sole owner of an animation. Unlike a shared_ptr, there's no control block to allocate.
+using AnimationHandle = std::unique_ptr<IAnimation, AnimationDeleter>;
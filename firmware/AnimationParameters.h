@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include "hardware/sync.h"
+#include "IAnimation.h"
+
+/// @brief Double buffered parameter values, written on core0 and read by core1
+/// @remarks Core0 writes the pending values under a sequence count. Core1 copies them into the active
+/// values at the start of a frame, and keeps its old values if a write was in progress, so a frame never
+/// sees a half changed set of parameters.
+template<size_t Count>
+class ParameterBlock
+{
+public:
+    ParameterBlock(const std::array<AnimationParameter, Count> &definitions) :
+        _definitions(definitions),
+        _sequence(0),
+        _latchedSequence(0)
+    {
+        for(size_t i = 0; i < Count; i++)
+            _pending[i] = _active[i] = definitions[i].defaultValue;
+    }
+
+    std::span<const AnimationParameter> Definitions() const { return _definitions; }
+
+    /// @brief Sets the starting value of a parameter, before the animation is running
+    void Initialise(int index, int32_t value)
+    {
+        _pending[index] = _active[index] = Clamp(index, value);
+    }
+
+    // Core0 side
+
+    int32_t Get(int index) const
+    {
+        return _pending[index];
+    }
+
+    bool Set(int index, int32_t value)
+    {
+        if(index < 0 || index >= (int)Count)
+            return false;
+
+        _sequence = _sequence + 1;  // Odd while writing
+        __dmb();
+        _pending[index] = Clamp(index, value);
+        __dmb();
+        _sequence = _sequence + 1;
+        return true;
+    }
+
+    // Core1 side
+
+    /// @brief Picks up any changed values. Call at the start of each frame.
+    /// @return true if any parameter changed
+    bool Latch()
+    {
+        uint32_t sequence = _sequence;
+        if(sequence == _latchedSequence || (sequence & 1))
+            return false;
+
+        __dmb();
+        std::array<int32_t, Count> values;
+        for(size_t i = 0; i < Count; i++)
+            values[i] = _pending[i];
+        __dmb();
+        if(_sequence != sequence)
+            return false;   // Changed again while copying, so try next frame
+
+        _active = values;
+        _latchedSequence = sequence;
+        return true;
+    }
+
+    int32_t operator[](int index) const
+    {
+        return _active[index];
+    }
+
+private:
+    int32_t Clamp(int index, int32_t value) const
+    {
+        return std::clamp(value, _definitions[index].minimum, _definitions[index].maximum);
+    }
+
+    const std::array<AnimationParameter, Count> &_definitions;
+    volatile int32_t _pending[Count];
+    std::array<int32_t, Count> _active;
+    volatile uint32_t _sequence;
+    uint32_t _latchedSequence;
+};
+
+/// @brief Animation with live tunable parameters, held in a ParameterBlock
+template<size_t Count>
+class TunableAnimation : public IAnimation
+{
+public:
+    TunableAnimation(const std::array<AnimationParameter, Count> &parameters) :
+        _parameters(parameters)
+    {
+    }
+
+    virtual std::span<const AnimationParameter> GetParameters() const override { return _parameters.Definitions(); }
+    virtual int32_t GetParameter(int index) const override { return index >= 0 && index < (int)Count ? _parameters.Get(index) : 0; }
+    virtual bool SetParameter(int index, int32_t value) override { return _parameters.Set(index, value); }
+
+protected:
+    ParameterBlock<Count> _parameters;
+};
@@ -0,0 +1,87 @@
+#include "mikuPixel.h"
+#include "AnimationPool.h"
+#include "hardware/sync.h"
+
+template<size_t SlotSize, size_t SlotCount>
+struct AnimationSlots
+{
+    alignas(AnimationSlotAlign) uint8_t memory[SlotCount][SlotSize];
+    bool used[SlotCount];
+
+    // Called with the pool lock held
+    void *Claim()
+    {
+        for(size_t slot = 0; slot < SlotCount; slot++)
+        {
+            if(!used[slot])
+            {
+                used[slot] = true;
+                return memory[slot];
+            }
+        }
+        return nullptr;
+    }
+
+    bool Contains(const uint8_t *address) const
+    {
+        return address >= &memory[0][0] && address < &memory[0][0] + sizeof(memory);
+    }
+
+    // Called with the pool lock held
+    void Release(const uint8_t *address)
+    {
+        used[(address - &memory[0][0]) / SlotSize] = false;
+    }
+};
+
+static AnimationSlots<SmallAnimationSlotSize, SmallAnimationSlotCount> _smallSlots;
+static AnimationSlots<LargeAnimationSlotSize, LargeAnimationSlotCount> _largeSlots;
+
+static spin_lock_t *_poolLock = nullptr;
+
+// Animations are built on one core and destroyed on the other, so the slot flags need a hardware lock.
+// It's claimed by the first allocation, which is always on core0 before any animation has reached the other core.
+static spin_lock_t *PoolLock()
+{
+    if(!_poolLock)
+        _poolLock = spin_lock_init(spin_lock_claim_unused(true));
+    return _poolLock;
+}
+
+void *AllocateAnimationMemory(size_t size)
+{
+    auto lock = PoolLock();
+    auto irq = spin_lock_blocking(lock);
+    void *memory = nullptr;
+    if(size <= SmallAnimationSlotSize)
+        memory = _smallSlots.Claim();
+    if(!memory && size <= LargeAnimationSlotSize)
+        memory = _largeSlots.Claim();
+    spin_unlock(lock, irq);
+    if(memory)
+        return memory;
+
+    DBG_PRINT("Animation pool is full, allocating %d bytes\n", size);
+    return ::operator new(size);
+}
+
+void AnimationDeleter::operator()(IAnimation *animation) const
+{
+    animation->~IAnimation();
+
+    auto memory = (uint8_t *)animation;
+    auto small = _smallSlots.Contains(memory);
+    if(!small && !_largeSlots.Contains(memory))
+    {
+        ::operator delete(memory);
+        return;
+    }
+
+    auto lock = PoolLock();
+    auto irq = spin_lock_blocking(lock);
+    if(small)
+        _smallSlots.Release(memory);
+    else
+        _largeSlots.Release(memory);
+    spin_unlock(lock, irq);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "AnimationHandle.h"
+
+#include "EditableImage.h"
+#include "animations/SolidMikuAnimation.h"
+#include "animations/SolidColourAnimation.h"
+#include "animations/PatternSequenceAnimation.h"
+#include "animations/WelcomeAnimation.h"
+#include "animations/RandomDropsAnimation.h"
+#include "animations/MikuPartCycleAnimation.h"
+#include "animations/PixelMapperAnimation.h"
+#include "animations/PulsingMikuAnimation.h"
+#include "animations/MikuSweepAnimation.h"
+#include "animations/PingAnimation.h"
+#include "animations/TrainAnimation.h"
+#include "animations/MarqueeAnimation.h"
+#include "animations/RippleAnimation.h"
+#include "animations/CometAnimation.h"
+#include "animations/FireworksAnimation.h"
+#include "animations/LayeredAnimation.h"
+#include "animations/EffectAnimation.h"
+
+// Animations are built in fixed pools of slots instead of on the heap, so switching effects can't fragment memory.
+// Only a few animations hold whole frames of pixels, so there are two sizes of slot, with enough of each for the
+// animation being shown, one waiting to be picked up by the runner and one being built, along with their layers and
+// any zone animations. Together they take about 40 KB.
+
+constexpr size_t AnimationSlotAlign = alignof(std::max_align_t);
+
+constexpr size_t RoundToAnimationSlot(size_t size)
+{
+    return (size + AnimationSlotAlign - 1) & ~(AnimationSlotAlign - 1);
+}
+
+// Animations that keep frames of pixels. Any animation bigger than this won't compile.
+constexpr size_t LargeAnimationSlotCount = 4;
+constexpr size_t LargeAnimationSlotSize = RoundToAnimationSlot(std::max({
+    sizeof(PatternSequenceAnimation),
+    sizeof(TrainAnimation),
+    sizeof(FireworksAnimation),
+    sizeof(LayeredAnimation)
+}));
+
+// Everything else. An animation that outgrows this still works, but takes a large slot.
+constexpr size_t SmallAnimationSlotCount = 12;
+constexpr size_t SmallAnimationSlotSize = RoundToAnimationSlot(std::max({
+    sizeof(EditableImage),
+    sizeof(SolidMikuAnimation),
+    sizeof(SolidColourAnimation),
+    sizeof(WelcomeAnimation),
+    sizeof(RandomDropsAnimation),
+    sizeof(MikuPartCycleAnimation),
+    sizeof(PixelMapperAnimation),
+    sizeof(PulsingMikuAnimation),
+    sizeof(MikuSweepAnimation),
+    sizeof(PingAnimation),
+    sizeof(MarqueeAnimation),
+    sizeof(RippleAnimation),
+    sizeof(CometAnimation),
+    sizeof(EffectAnimation)
+}));
+
+/// @brief Claims the smallest free slot that fits
+/// @remarks Falls back to the heap if every slot that fits is in use
+void *AllocateAnimationMemory(size_t size);
+
+/// @brief Builds an animation in the animation pool
+template<typename T, typename... Args>
+AnimationHandle MakeAnimation(Args&&... args)
+{
+    static_assert(sizeof(T) <= LargeAnimationSlotSize, "Animation is too big for the pool. Add it to LargeAnimationSlotSize.");
+    static_assert(alignof(T) <= AnimationSlotAlign);
+    auto memory = AllocateAnimationMemory(sizeof(T));
+    return AnimationHandle(new(memory) T(std::forward<Args>(args)...));
+}
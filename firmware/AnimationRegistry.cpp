@@ -0,0 +1,94 @@
+#include "mikuPixel.h"
+#include "AnimationRegistry.h"
+#include "Miku.h"
+#include <algorithm>
+#include <array>
+
+#include "AnimationPool.h"
+
+template<typename T, auto... Args>
+static AnimationHandle Make()
+{
+    return MakeAnimation<T>(Args...);
+}
+
+static AnimationHandle MakeTrainsOverMiku()
+{
+    auto layers = MakeAnimation<LayeredAnimation>();
+    auto layered = static_cast<LayeredAnimation *>(layers.get());
+    layered->AddLayer(MakeAnimation<SolidMikuAnimation>(32));
+    layered->AddLayer(MakeAnimation<TrainAnimation>(), BlendMode::Max);
+    return layers;
+}
+
+// Built-in animations. New animations must go on the end, as the index is saved in the light config.
+static constexpr AnimationInfo Animations[] = {
+    {"solid", "Solid Miku", Make<SolidMikuAnimation, 128>},
+    {"pulsing", "Pulsing Miku", Make<PulsingMikuAnimation>},
+    {"slowcycle", "Miku Part Cycle Slow", Make<MikuPartCycleAnimation, 1>},
+    {"fastcycle", "Miku Part Cycle Fast", Make<MikuPartCycleAnimation, 8>},
+    {"sweep", "Miku Sweep", Make<MikuSweepAnimation>},
+    {"welcome", "Welcome Sweep", Make<WelcomeAnimation, PIXEL_COUNT>},
+    {"mapper", "LED Mapper", Make<PixelMapperAnimation, PIXEL_COUNT, 4>},
+    {"ping", "Wifi Ping", Make<PingAnimation>},
+    {"drops", "Random Drops", Make<RandomDropsAnimation>},
+    {"trains", "Trains", Make<TrainAnimation>},
+    {"marquee", "Marquee", Make<MarqueeAnimation>},
+    {"rushhour", "Rush Hour Trains", Make<TrainAnimation, 12>},
+    {"ripples", "Ripples", Make<RippleAnimation>},
+    {"comets", "Comets", Make<CometAnimation>},
+    {"fireworks", "Fireworks", Make<FireworksAnimation>},
+    {"mikutrains", "Trains Over Miku", MakeTrainsOverMiku},
+};
+
+struct AnimationNameHash
+{
+    uint32_t hash;
+    int animationId;
+};
+
+// Hashes of both names of every animation, sorted for a binary search
+static constexpr auto BuildNameIndex()
+{
+    std::array<AnimationNameHash, std::size(Animations) * 2> index{};
+    for(size_t i = 0; i < std::size(Animations); i++)
+    {
+        index[i * 2] = { HashAnimationName(Animations[i].name), (int)i };
+        index[i * 2 + 1] = { HashAnimationName(Animations[i].description), (int)i };
+    }
+    std::sort(index.begin(), index.end(), [](const auto &a, const auto &b) { return a.hash < b.hash; });
+    return index;
+}
+
+static constexpr auto AnimationNameIndex = BuildNameIndex();
+
+static constexpr bool AreNameHashesUnique()
+{
+    for(size_t i = 1; i < AnimationNameIndex.size(); i++)
+    {
+        if(AnimationNameIndex[i].hash == AnimationNameIndex[i - 1].hash)
+            return false;
+    }
+    return true;
+}
+static_assert(AreNameHashesUnique(), "Animation names must be unique");
+
+std::span<const AnimationInfo> GetAnimations()
+{
+    return Animations;
+}
+
+int FindAnimation(std::string_view name)
+{
+    auto hash = HashAnimationName(name);
+    auto it = std::lower_bound(AnimationNameIndex.begin(), AnimationNameIndex.end(), hash,
+        [](const AnimationNameHash &entry, uint32_t hash) { return entry.hash < hash; });
+    if(it == AnimationNameIndex.end() || it->hash != hash)
+        return -1;
+
+    // Make sure it wasn't just a hash collision with an unknown name
+    auto &animation = Animations[it->animationId];
+    if(name != animation.name && name != animation.description)
+        return -1;
+    return it->animationId;
+}
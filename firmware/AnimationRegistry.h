@@ -0,0 +1,33 @@
+#pragma once
+
+#include "AnimationHandle.h"
+#include <span>
+#include <string_view>
+
+using AnimationFactory = AnimationHandle (*)();
+
+struct AnimationInfo
+{
+    const char *name;           // Short name, used for the MQTT effect list
+    const char *description;
+    AnimationFactory factory;
+};
+
+/// @brief FNV-1a hash of an animation name
+constexpr uint32_t HashAnimationName(std::string_view name)
+{
+    uint32_t hash = 2166136261u;
+    for(auto c : name)
+    {
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// @brief All the built-in animations. The index is the animation ID saved in the light config.
+std::span<const AnimationInfo> GetAnimations();
+
+/// @brief Finds an animation by its short name or its description
+/// @return The animation ID, or -1 if there is no such animation
+int FindAnimation(std::string_view name);
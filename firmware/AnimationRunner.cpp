@@ -4,6 +4,8 @@
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 #include "pico/flash.h"
+#include <string.h>
+#include <algorithm>
 
 class SpinLock
 {
@@ -24,13 +26,107 @@ private:
 
 static AnimationRunner *_theRunner = nullptr;
 
-void AnimationRunner::SetAnimation(std::shared_ptr<IAnimation> animation)
+// How long to wait for the worker to get ready for a flash write before stopping it anyway, in ms
+static constexpr uint32_t FlashHandshakeTimeout = 100;
+// Frames are drawn to cover the flash write, plus this much, in microseconds
+static constexpr uint32_t FlashMargin = 2000;
+
+void AnimationRunner::SetAnimation(AnimationHandle animation)
 {
-    SpinLock lock(_setLock);
-    __compiler_memory_barrier();
-    if(_stopRequested)
-        return;
-    _newAnimation = std::move(animation);
+    // Zones are drawn over the main animation, so a new main animation starts without them
+    _zoneCount = 0;
+
+    // Animations that were never picked up are destroyed once the lock is released
+    AnimationHandle dropped;
+    std::array<AnimationHandle, MaxZones> droppedZones;
+    {
+        SpinLock lock(_setLock);
+        __compiler_memory_barrier();
+        if(_stopRequested)
+            return;
+        dropped = std::move(_newAnimation);
+        _animation = animation.get();
+        _newAnimation = std::move(animation);
+        DropNewZones(droppedZones);
+        _newZoneCount = 0;
+        _zonesChanged = true;
+    }
+}
+
+bool AnimationRunner::SetZoneAnimation(const MikuPart &part, AnimationHandle animation)
+{
+    const MikuPart parts[] = { part, NullPart };
+    return SetZoneAnimation(parts, std::move(animation));
+}
+
+bool AnimationRunner::SetZoneAnimation(const MikuPart *parts, AnimationHandle animation)
+{
+    ZonePixels pixels;
+    for(; parts->index >= 0; parts++)
+    {
+        if(pixels.rangeCount >= MaxZoneRanges)
+        {
+            DBG_PUT("Too many parts in zone");
+            return false;
+        }
+        pixels.ranges[pixels.rangeCount++] = { (uint16_t)parts->index, (uint16_t)parts->length };
+    }
+
+    auto zone = std::find(_zones.begin(), _zones.begin() + _zoneCount, pixels) - _zones.begin();
+    if(zone == _zoneCount)
+    {
+        if(_zoneCount >= MaxZones)
+        {
+            DBG_PUT("No free animation zones");
+            return false;
+        }
+        _zones[_zoneCount++] = pixels;
+    }
+
+    auto pixelCount = _pixels->GetPixelCount();
+    if(!_zoneBuffers[zone])
+        _zoneBuffers[zone] = std::make_unique<neopixel[]>(pixelCount * 2);
+
+    AnimationHandle dropped;
+    {
+        SpinLock lock(_setLock);
+        __compiler_memory_barrier();
+        if(_stopRequested)
+            return false;
+        dropped = std::move(_newZones[zone].animation);
+        _newZones[zone].animation = std::move(animation);
+        _newZones[zone].pixels = pixels;
+        _newZones[zone].buffers[0] = _zoneBuffers[zone].get();
+        _newZones[zone].buffers[1] = _zoneBuffers[zone].get() + pixelCount;
+        _updatedZones |= 1 << zone;
+        _newZoneCount = _zoneCount;
+        _zonesChanged = true;
+    }
+    return true;
+}
+
+void AnimationRunner::ClearZones()
+{
+    _zoneCount = 0;
+
+    std::array<AnimationHandle, MaxZones> droppedZones;
+    {
+        SpinLock lock(_setLock);
+        __compiler_memory_barrier();
+        if(_stopRequested)
+            return;
+        DropNewZones(droppedZones);
+        _newZoneCount = 0;
+        _zonesChanged = true;
+    }
+}
+
+void AnimationRunner::DropNewZones(std::array<AnimationHandle, MaxZones> &dropped)
+{
+    // Called with the lock held. The caller destroys the animations after releasing it.
+    for(auto i = 0; i < MaxZones; i++)
+        dropped[i] = std::move(_newZones[i].animation);
+    _updatedZones = 0;
 }
 
 void AnimationRunner::Shutdown()
@@ -40,6 +136,18 @@ void AnimationRunner::Shutdown()
     _stopRequested = true;
 }
 
+uint32_t AnimationRunner::IdleTime() const
+{
+    if(!_idle)
+        return 0;
+    __dmb();
+    int32_t remaining = _idleUntil - time_us_32();
+    __dmb();
+    if(!_idle)
+        return 0;
+    return std::max<int32_t>(remaining, 0);
+}
+
 void AnimationRunner::Start()
 {
     _theRunner = this;
@@ -64,12 +172,206 @@ void AnimationRunner::Start()
     });
 }
 
+void AnimationRunner::TakeNewZones(std::array<ZoneState, MaxZones> &zones, int &zoneCount)
+{
+    // Zones keep their slot when their animation is replaced, so the others carry on where they left off
+    for(auto i = 0; i < _newZoneCount; i++)
+    {
+        if(_updatedZones & (1 << i))
+        {
+            auto &state = zones[i];
+            state.zone.animation = std::move(_newZones[i].animation);
+            state.zone.pixels = _newZones[i].pixels;
+            state.zone.buffers[0] = _newZones[i].buffers[0];
+            state.zone.buffers[1] = _newZones[i].buffers[1];
+            state.frameCounter = 0;
+            state.remaining = 0;
+        }
+    }
+
+    for(auto i = _newZoneCount; i < zoneCount; i++)
+        zones[i].zone.animation.reset();
+
+    zoneCount = _newZoneCount;
+    _updatedZones = 0;
+}
+
+int32_t AnimationRunner::DrawFrame(NeoPixelFrame frame, WorkerState &state, uint32_t lastFrameDelay)
+{
+    auto pixelCount = frame.GetPixelCount();
+
+    // Draw the current animation frame, if it is due.
+    // Otherwise the back buffer is two frames old, so bring it up to date with the frame being shown.
+    state.remaining -= lastFrameDelay;
+    auto animationDrawn = state.remaining <= 0;
+    if(animationDrawn)
+    {
+        state.remaining = state.animation ? state.animation->DrawFrame(frame, state.frameCounter) : 1000;
+        state.frameCounter++;
+    }
+    else
+    {
+        ::memcpy(frame.GetBuffer(), frame.GetLastBuffer(), sizeof(neopixel) * pixelCount);
+    }
+    int32_t frameDelay = state.remaining;
+
+    // Only redraw the zones that are due, and copy them over the main animation
+    for(auto i = 0; i < state.zoneCount; i++)
+    {
+        auto &zone = state.zones[i];
+        zone.remaining -= lastFrameDelay;
+        auto zoneDrawn = zone.remaining <= 0;
+        if(zoneDrawn)
+        {
+            auto previous = zone.current;
+            zone.current ^= 1;
+            zone.remaining = std::max<int32_t>(1, zone.zone.animation->DrawFrame(
+                NeoPixelFrame(zone.zone.buffers[zone.current], zone.zone.buffers[previous], pixelCount),
+                zone.frameCounter++));
+        }
+
+        if(zoneDrawn || animationDrawn)
+        {
+            auto source = zone.zone.buffers[zone.current];
+            for(auto r = 0; r < zone.zone.pixels.rangeCount; r++)
+            {
+                auto &range = zone.zone.pixels.ranges[r];
+                auto count = std::min<uint32_t>(range.count, pixelCount - std::min<uint32_t>(range.first, pixelCount));
+                ::memcpy(frame.GetBuffer() + range.first, source + range.first, sizeof(neopixel) * count);
+            }
+        }
+        frameDelay = std::min(frameDelay, zone.remaining);
+    }
+    return frameDelay;
+}
+
+int AnimationRunner::ExecuteFlash(void (*func)(void *), void *param, uint32_t busyTime)
+{
+    auto timeout = make_timeout_time_ms(FlashHandshakeTimeout);
+
+    // Wait for the worker to finish playing the frames from the last write
+    while(true)
+    {
+        {
+            SpinLock lock(_setLock);
+            __compiler_memory_barrier();
+            if(!_workerRunning)
+                break;
+            if(_flashState == FlashState::Idle)
+            {
+                _flashBusyTime = busyTime;
+                _flashState = FlashState::Requested;
+                break;
+            }
+        }
+        if(time_reached(timeout))
+        {
+            // The worker is still showing the frames from the last write, with interrupts on again by now
+            return flash_safe_execute(func, param, 1000);
+        }
+        tight_loop_contents();
+    }
+
+    if(_flashState == FlashState::Requested)
+    {
+        // Wake the worker if it's waiting for the next frame
+        __sev();
+        while(_flashState == FlashState::Requested && !time_reached(timeout))
+            tight_loop_contents();
+
+        SpinLock lock(_setLock);
+        __compiler_memory_barrier();
+        if(_flashState == FlashState::Requested)
+            _flashState = FlashState::Idle;
+    }
+
+    if(_flashState != FlashState::Ready)
+    {
+        // The worker isn't running, or is too busy drawing to answer, so stop it the usual way
+        return flash_safe_execute(func, param, 1000);
+    }
+
+    // The worker is running from RAM, so only this core needs to stay off the flash
+    auto irq = save_and_disable_interrupts();
+    func(param);
+    restore_interrupts(irq);
+    __dmb();
+    _flashBusy = false;
+    return PICO_OK;
+}
+
+uint32_t AnimationRunner::PlayThroughFlash(WorkerState &state, NeoPixelFrame frame, uint32_t frameDelay, absolute_time_t showTime)
+{
+    auto pixelCount = frame.GetPixelCount();
+
+    // The frame already drawn goes first, then enough more to cover the flash write
+    std::array<const neopixel *, PrerenderFrames + 1> frames;
+    std::array<uint32_t, PrerenderFrames + 1> showTimes;
+    frames[0] = frame.GetBuffer();
+    showTimes[0] = (uint32_t)to_us_since_boot(showTime);
+    auto count = 1;
+    auto coverUntil = time_us_32() + _flashBusyTime + FlashMargin;
+    while(count <= PrerenderFrames && (int32_t)(showTimes[count - 1] + frameDelay * 1000 - coverUntil) < 0)
+    {
+        auto &buffer = _prerendered[count - 1];
+        showTimes[count] = showTimes[count - 1] + frameDelay * 1000;
+        frameDelay = DrawFrame(NeoPixelFrame(buffer.data(), frames[count - 1], pixelCount), state, frameDelay);
+        frames[count] = buffer.data();
+        count++;
+    }
+
+    _pixels->BeginPolledOutput();
+    auto shown = PlayFromRam(_pixels.get(), frames.data(), showTimes.data(), count);
+    {
+        SpinLock lock(_setLock);
+        __compiler_memory_barrier();
+        if(_flashState == FlashState::Ready)
+            _flashState = FlashState::Idle;
+    }
+
+    // The flash is free again, so the frames that weren't due yet are shown as usual
+    for(auto i = shown; i < count; i++)
+    {
+        auto wait = (int32_t)(showTimes[i] - time_us_32());
+        if(wait > 0)
+            sleep_us(wait);
+        _pixels->ShowPolled(frames[i]);
+    }
+    _pixels->EndPolledOutput(frames[count - 1]);
+    return frameDelay;
+}
+
+int __not_in_flash_func(AnimationRunner::PlayFromRam)(NeoPixelBuffer *pixels, const neopixel *const *frames, const uint32_t *showTimes, int count)
+{
+    // The other core starts writing as soon as it sees Ready, so from here on nothing may touch flash. Only inlined
+    // SDK functions are used, and interrupts are off before Ready is set so a handler in flash can't run either.
+    auto irq = save_and_disable_interrupts();
+    spin_lock_unsafe_blocking(_setLock);
+    __compiler_memory_barrier();
+    auto ready = _flashState == FlashState::Requested;
+    if(ready)
+    {
+        _flashBusy = true;
+        _flashState = FlashState::Ready;
+    }
+    __compiler_memory_barrier();
+    spin_unlock_unsafe(_setLock);
+
+    // The request was given up on, so the frames are all shown as usual
+    auto shown = ready ? pixels->PlayFromRam(frames, showTimes, count, _flashBusy) : 0;
+    restore_interrupts(irq);
+    return shown;
+}
+
 void AnimationRunner::Worker()
 {
-    uint32_t frameCounter = 0;
     uint32_t lastFrameDelay = 0;
+    WorkerState state;
 
-    std::shared_ptr<IAnimation> currentAnimation;
+    {
+        SpinLock lock(_setLock);
+        _workerRunning = true;
+    }
 
     while(true)
     {
@@ -81,10 +383,16 @@ void AnimationRunner::Worker()
 
             if(_newAnimation)
             {
-                currentAnimation = std::move(_newAnimation);
-                frameCounter = 0;
+                state.animation = std::move(_newAnimation);
+                state.frameCounter = 0;
+                state.remaining = 0;
                 lastFrameDelay = 0;
             }
+            if(_zonesChanged)
+            {
+                TakeNewZones(state.zones, state.zoneCount);
+                _zonesChanged = false;
+            }
             __compiler_memory_barrier();
         }
 
@@ -92,9 +400,7 @@ void AnimationRunner::Worker()
 
         // Show the previous frame
         auto frame = _pixels->Swap(); 
-        // Draw the current animation frame
-        auto frameDelay = currentAnimation ? currentAnimation->DrawFrame(frame, frameCounter) : 1000;
-        frameCounter++;
+        int32_t frameDelay = DrawFrame(frame, state, lastFrameDelay);
 
         // Wait until the previous frame has been shown for the required time
         absolute_time_t targetTime = delayed_by_ms(frameStart, lastFrameDelay);
@@ -116,24 +422,43 @@ void AnimationRunner::Worker()
         #endif
         */
         
-        while(true)
+        // The frame has gone out, so the worker has nothing to do until the next one is due
+        _idleUntil = (uint32_t)to_us_since_boot(targetTime);
+        __dmb();
+        _idle = true;
+
+        while(_flashState != FlashState::Requested)
         {
             if((int64_t)(targetTime - get_absolute_time()) <= 1000000ll) // microseconds
             {
-                sleep_until(targetTime);
-                break;
+                // Woken early by the other core wanting to write flash, or anything else
+                if(best_effort_wfe_or_timeout(targetTime))
+                    break;
+                continue;
             }
 
             // Sleep for a short time to allow early exit
-            sleep_ms(500);
+            best_effort_wfe_or_timeout(make_timeout_time_ms(500));
             {
                 SpinLock lock(_setLock);
                 __compiler_memory_barrier();
-                if (_stopRequested || _newAnimation)
+                if (_stopRequested || _newAnimation || _zonesChanged)
                     break;
             }
         }
         
+        _idle = false;
+        __dmb();
+
+        if(_flashState == FlashState::Requested)
+            frameDelay = PlayThroughFlash(state, frame, frameDelay, targetTime);
         lastFrameDelay = frameDelay;
     }
+
+    {
+        SpinLock lock(_setLock);
+        _workerRunning = false;
+        if(_flashState == FlashState::Requested)
+            _flashState = FlashState::Idle;
+    }
 }
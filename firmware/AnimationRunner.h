@@ -1,43 +1,171 @@
 #pragma once
 
 #include <memory>
+#include <algorithm>
+#include <array>
+#include <vector>
 #include "pico/sem.h"
 #include "NeoPixelBuffer.h"
 #include "IAnimation.h"
+#include "AnimationHandle.h"
+#include "Miku.h"
 
 class IAnimation;
 
 class AnimationRunner
 {
 public:
+    static constexpr int MaxZones = 4;
+    static constexpr int MaxZoneRanges = 6;
+
     AnimationRunner(std::unique_ptr<NeoPixelBuffer> pixels) :
         _pixels(std::move(pixels)),
-        _stopRequested(false)
+        _animation(nullptr),
+        _zoneCount(0),
+        _updatedZones(0),
+        _newZoneCount(0),
+        _zonesChanged(false),
+        _stopRequested(false),
+        _workerRunning(false),
+        _flashState(FlashState::Idle),
+        _flashBusy(false),
+        _flashBusyTime(0)
     {
         _lockNum = spin_lock_claim_unused(true);
         _setLock = spin_lock_init(_lockNum);
+
+        // The worker never allocates, so the frames it draws ahead into are made here
+        for(auto &buffer : _prerendered)
+            buffer.resize(_pixels->GetPixelCount());
     }
 
     void Start();
 
     void Shutdown();
 
-    void SetAnimation(std::shared_ptr<IAnimation> animation);
+    /// @brief Replaces the main animation, and removes any zone animations
+    void SetAnimation(AnimationHandle animation);
+
+    /// @brief The main animation most recently set, for tuning its parameters
+    /// @remarks Only for use on the core that sets the animations. It stays valid until the next SetAnimation.
+    IAnimation *GetAnimation() const { return _animation; }
+
+    /// @brief Runs an animation on just the pixels of a zone, over the top of the main animation
+    /// @remarks Each zone keeps its own frame timing, and is only redrawn when its next frame is due.
+    /// Setting the animation for an existing zone replaces it.
+    /// @param parts NullPart terminated list of the parts making up the zone, such as MikuHairBands
+    /// @return false if the zone has too many parts, or all the zones are in use
+    bool SetZoneAnimation(const MikuPart *parts, AnimationHandle animation);
+    bool SetZoneAnimation(const MikuPart &part, AnimationHandle animation);
+
+    /// @brief Removes all the zone animations, leaving just the main animation
+    void ClearZones();
+
+    /// @brief How long the worker core has left to wait before its next frame
+    /// @return microseconds, or 0 while a frame is being drawn
+    /// @remarks Flash writes are fitted into these gaps where they can, so fewer frames need drawing ahead
+    uint32_t IdleTime() const;
+
+    /// @brief Runs a flash write while the animation carries on from frames drawn ahead into RAM
+    /// @remarks A drop in for flash_safe_execute, which it falls back to if the worker doesn't answer in time.
+    /// @param busyTime roughly how long the write keeps the flash busy, in microseconds
+    int ExecuteFlash(void (*func)(void *), void *param, uint32_t busyTime);
 
     AnimationRunner(const AnimationRunner&) = delete;
     AnimationRunner& operator=(const AnimationRunner&) = delete;
 private:
 
-    void Worker();
+    struct PixelRange
+    {
+        uint16_t first;
+        uint16_t count;
+
+        bool operator==(const PixelRange &other) const { return first == other.first && count == other.count; }
+    };
+
+    struct ZonePixels
+    {
+        std::array<PixelRange, MaxZoneRanges> ranges;
+        int rangeCount = 0;
+
+        bool operator==(const ZonePixels &other) const
+        {
+            return rangeCount == other.rangeCount && std::equal(ranges.begin(), ranges.begin() + rangeCount, other.ranges.begin());
+        }
+    };
 
+    struct Zone
+    {
+        AnimationHandle animation;
+        ZonePixels pixels;
+        neopixel *buffers[2] = {};  // Full size frames for the zone's slot, owned by the runner
+    };
+
+    // Worker state for a zone. Each zone draws into its own full size frames, which are then copied into its pixels.
+    struct ZoneState
+    {
+        Zone zone;
+        int current = 0;
+        uint32_t frameCounter = 0;
+        int32_t remaining = 0;     // ms until the zone's next frame is due
+    };
+
+    // Animations and timing owned by the worker
+    struct WorkerState
+    {
+        AnimationHandle animation;
+        uint32_t frameCounter = 0;
+        int32_t remaining = 0;     // ms until the main animation's next frame is due
+        std::array<ZoneState, MaxZones> zones;
+        int zoneCount = 0;
+    };
+
+    enum class FlashState : uint8_t
+    {
+        Idle,
+        Requested,  // The other core wants to write flash
+        Ready       // The worker is playing frames from RAM, until the write is done
+    };
+
+    // Enough to cover a sector erase at typical frame rates. The last frame is held if the write takes longer.
+    static constexpr int PrerenderFrames = 8;
+
+    void Worker();
+    int32_t DrawFrame(NeoPixelFrame frame, WorkerState &state, uint32_t lastFrameDelay);
+    uint32_t PlayThroughFlash(WorkerState &state, NeoPixelFrame frame, uint32_t frameDelay, absolute_time_t showTime);
+    int PlayFromRam(NeoPixelBuffer *pixels, const neopixel *const *frames, const uint32_t *showTimes, int count);
+    void TakeNewZones(std::array<ZoneState, MaxZones> &zones, int &zoneCount);
+    void DropNewZones(std::array<AnimationHandle, MaxZones> &dropped);
 
     std::unique_ptr<NeoPixelBuffer> _pixels;
 
-    std::shared_ptr<IAnimation> _newAnimation;
+    AnimationHandle _newAnimation;
+    IAnimation *_animation;
+
+    // Zones as set on the calling core, and the changes waiting to be picked up by the worker
+    std::array<ZonePixels, MaxZones> _zones;
+    int _zoneCount;
+    std::array<Zone, MaxZones> _newZones;
+    // Frames for each zone slot, made the first time the slot is used and then kept, as the worker mustn't allocate
+    std::array<std::unique_ptr<neopixel[]>, MaxZones> _zoneBuffers;
+    uint32_t _updatedZones;     // Bit mask of the zones with a new animation
+    int _newZoneCount;
+    bool _zonesChanged;
 
     int _lockNum;
     spin_lock_t *_setLock;
     volatile bool _stopRequested = false;
 
+    // Set by the worker while it waits for the next frame to be due
+    volatile uint32_t _idleUntil = 0;   // time_us_32 when the wait ends
+    volatile bool _idle = false;
+
+    // Handshake for writing flash without stopping the worker. Changes of state are made under the lock.
+    bool _workerRunning;
+    volatile FlashState _flashState;
+    volatile bool _flashBusy;           // Set until the write is done
+    uint32_t _flashBusyTime;            // How long the write will take, in microseconds
+    std::array<std::vector<neopixel>, PrerenderFrames> _prerendered;
+
 };
 
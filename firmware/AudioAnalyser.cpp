@@ -0,0 +1,186 @@
+
+#include "AudioAnalyser.h"
+#include <algorithm>
+
+static constexpr int FftBits = 8;
+static_assert((1u << FftBits) == AudioFftSize);
+
+// Sine of a full turn over AudioFftSize steps, in Q15. Only the first three quarters are needed for the twiddles.
+static constexpr std::array<int16_t, AudioFftSize> BuildSineTable()
+{
+    std::array<int16_t, AudioFftSize> table{};
+    constexpr double pi = 3.14159265358979323846;
+    for(size_t i = 0; i < AudioFftSize; i++)
+    {
+        // Fold into -pi/2 to pi/2, where a short Taylor series is plenty accurate
+        double x = (i < AudioFftSize / 2 ? (double)i : (double)i - AudioFftSize) * 2 * pi / AudioFftSize;
+        if(x > pi / 2)
+            x = pi - x;
+        else if(x < -pi / 2)
+            x = -pi - x;
+        double x2 = x * x;
+        double s = x * (1 - x2 / 6 * (1 - x2 / 20 * (1 - x2 / 42 * (1 - x2 / 72 * (1 - x2 / 110)))));
+        double scaled = s * 32767;
+        table[i] = (int16_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    }
+    return table;
+}
+
+static constexpr auto SineTable = BuildSineTable();
+
+// Hann window in Q15, symmetric so only the first half is stored
+static constexpr std::array<int16_t, AudioFftSize / 2> BuildWindow()
+{
+    std::array<int16_t, AudioFftSize / 2> window{};
+    for(size_t i = 0; i < AudioFftSize / 2; i++)
+    {
+        // 0.5 - 0.5 * cos(2 pi i / N), with cos from the sine table a quarter turn on
+        window[i] = (int16_t)((32767 - SineTable[(i + AudioFftSize / 4) % AudioFftSize]) / 2);
+    }
+    return window;
+}
+
+static constexpr auto Window = BuildWindow();
+
+static constexpr std::array<uint8_t, AudioFftSize> BuildBitReverse()
+{
+    std::array<uint8_t, AudioFftSize> table{};
+    for(size_t i = 0; i < AudioFftSize; i++)
+    {
+        size_t reversed = 0;
+        for(int bit = 0; bit < FftBits; bit++)
+            reversed |= ((i >> bit) & 1) << (FftBits - 1 - bit);
+        table[i] = (uint8_t)reversed;
+    }
+    return table;
+}
+
+static constexpr auto BitReverse = BuildBitReverse();
+
+// First FFT bin of each band, doubling each time. The last band stops at the Nyquist bin.
+static constexpr std::array<uint8_t, AudioBandCount + 1> BandEdges = { 1, 2, 4, 8, 16, 32, 64, 96, AudioFftSize / 2 };
+
+/// @brief In place radix 2 FFT in Q15, halving at each stage so it can't overflow
+static void Fft(std::array<int16_t, AudioFftSize> &real, std::array<int16_t, AudioFftSize> &imaginary)
+{
+    for(size_t i = 0; i < AudioFftSize; i++)
+    {
+        auto j = BitReverse[i];
+        if(i < j)
+        {
+            std::swap(real[i], real[j]);
+            std::swap(imaginary[i], imaginary[j]);
+        }
+    }
+
+    for(size_t half = 1, step = AudioFftSize / 2; half < AudioFftSize; half *= 2, step /= 2)
+    {
+        for(size_t k = 0; k < half; k++)
+        {
+            // Twiddle e^(-2 pi i k / (2 half))
+            int32_t wr = SineTable[(k * step + AudioFftSize / 4) % AudioFftSize];
+            int32_t wi = -SineTable[k * step];
+            for(size_t i = k; i < AudioFftSize; i += half * 2)
+            {
+                auto j = i + half;
+                int32_t tr = (wr * real[j] - wi * imaginary[j]) >> 15;
+                int32_t ti = (wr * imaginary[j] + wi * real[j]) >> 15;
+                int32_t ur = real[i];
+                int32_t ui = imaginary[i];
+                real[i] = (int16_t)((ur + tr) >> 1);
+                imaginary[i] = (int16_t)((ui + ti) >> 1);
+                real[j] = (int16_t)((ur - tr) >> 1);
+                imaginary[j] = (int16_t)((ui - ti) >> 1);
+            }
+        }
+    }
+}
+
+/// @brief log2 in 8.8 fixed point, with 0 for 0
+static int32_t Log2Fixed(uint64_t value)
+{
+    if(value == 0)
+        return 0;
+
+    int32_t whole = 63;
+    while(!(value >> whole))
+        whole--;
+
+    // Take the 8 bits below the leading one as a linear guess at the fraction
+    auto fraction = whole >= 8 ? (value >> (whole - 8)) & 0xFF : (value << (8 - whole)) & 0xFF;
+    return (whole << 8) | (int32_t)fraction;
+}
+
+// Anything quieter than this is just ADC noise, in 8.8 log2 of the energy
+static constexpr int32_t NoiseFloor = 12 << 8;
+// Ranges narrower than this would turn noise into full scale flicker
+static constexpr int32_t MinimumRange = 4 << 8;
+
+AudioAnalyser::AudioAnalyser()
+:   _bassAverage(0),
+    _bassAbove(false),
+    _blockCount(0)
+{
+    _peaks.fill(NoiseFloor + MinimumRange);
+    _floors.fill(NoiseFloor);
+}
+
+AudioLevels AudioAnalyser::Process(const uint16_t *samples)
+{
+    // Remove the DC bias of the microphone, then window into Q15 (12 bit samples shifted up by 3)
+    int32_t sum = 0;
+    for(size_t i = 0; i < AudioFftSize; i++)
+        sum += samples[i];
+    int32_t mean = sum / (int32_t)AudioFftSize;
+
+    for(size_t i = 0; i < AudioFftSize; i++)
+    {
+        int32_t sample = ((int32_t)samples[i] - mean) << 3;
+        int32_t window = Window[i < AudioFftSize / 2 ? i : AudioFftSize - 1 - i];
+        _real[i] = (int16_t)std::clamp((sample * window) >> 15, -32768, 32767);
+        _imaginary[i] = 0;
+    }
+
+    Fft(_real, _imaginary);
+
+    AudioLevels levels = {};
+    uint64_t total = 0;
+    std::array<int32_t, AudioBandCount + 1> loudness;
+    for(size_t band = 0; band < AudioBandCount; band++)
+    {
+        uint64_t energy = 0;
+        for(size_t bin = BandEdges[band]; bin < BandEdges[band + 1]; bin++)
+            energy += (uint64_t)((int32_t)_real[bin] * _real[bin] + (int32_t)_imaginary[bin] * _imaginary[bin]);
+        total += energy;
+        loudness[band] = Log2Fixed(energy);
+    }
+    loudness[AudioBandCount] = Log2Fixed(total);
+
+    // Automatic gain: peaks jump up and slowly fall, floors slowly rise and jump down
+    for(size_t i = 0; i <= AudioBandCount; i++)
+    {
+        auto value = std::max(loudness[i], NoiseFloor);
+        _peaks[i] = std::max(value, _peaks[i] - 4);
+        _floors[i] = std::min(value, _floors[i] + 2);
+        auto range = std::max(_peaks[i] - _floors[i], MinimumRange);
+        auto scaled = std::clamp((value - _floors[i]) * 255 / range, 0, 255);
+        if(i < AudioBandCount)
+            levels.bands[i] = (uint8_t)scaled;
+        else
+            levels.level = (uint8_t)scaled;
+    }
+
+    levels.bass = (uint8_t)((levels.bands[0] + levels.bands[1]) / 2);
+    levels.active = loudness[AudioBandCount] > NoiseFloor + MinimumRange;
+
+    // A beat is the bass jumping well above its running average. A kick lasts a few blocks, but is only one beat.
+    int32_t bass = levels.bass << 8;
+    auto above = levels.active && bass > _bassAverage + (64 << 8);
+    levels.beat = above && !_bassAbove;
+    _bassAbove = above;
+    _bassAverage += (bass - _bassAverage) / 8;
+
+    levels.block = ++_blockCount;
+
+    return levels;
+}
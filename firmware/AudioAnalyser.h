@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t AudioFftSize = 256;
+constexpr size_t AudioBandCount = 8;
+constexpr uint32_t AudioSampleRate = 10240;  // 40Hz per FFT bin
+
+/// @brief Loudness of the latest block of audio, each 0-255 relative to what's been heard recently
+struct AudioLevels
+{
+    std::array<uint8_t, AudioBandCount> bands;  // Octave bands from 40Hz up to 5kHz
+    uint8_t bass;       // 40-160Hz
+    uint8_t level;      // Whole spectrum
+    bool beat;          // The bass jumped well above its recent average. Only set on the first block of the jump.
+    bool active;        // There's enough signal to be worth reacting to
+    uint32_t block;     // Counts the blocks analysed, so a beat can be told apart from one already seen
+};
+
+/// @brief Turns blocks of ADC samples into band levels, with a fixed point FFT
+/// @remarks Has no hardware dependencies, so it can be fed recorded audio off the device
+class AudioAnalyser
+{
+public:
+    AudioAnalyser();
+
+    /// @brief Analyses one block of samples
+    /// @param samples 12 bit unsigned ADC readings, AudioFftSize of them
+    AudioLevels Process(const uint16_t *samples);
+
+private:
+    // Recent loudness of each band, as 8.8 fixed point log2 of the energy
+    std::array<int32_t, AudioBandCount + 1> _peaks;
+    std::array<int32_t, AudioBandCount + 1> _floors;
+    int32_t _bassAverage;
+    bool _bassAbove;        // The bass was well above its average in the last block
+    uint32_t _blockCount;
+
+    std::array<int16_t, AudioFftSize> _real;
+    std::array<int16_t, AudioFftSize> _imaginary;
+};
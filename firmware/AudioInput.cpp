@@ -0,0 +1,132 @@
+
+#include "mikuPixel.h"
+#include "AudioInput.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+static AudioInput *_audioInput = nullptr;
+
+// Levels published by core0 for core1. The sequence is odd while they are being written.
+static volatile uint32_t _levelsSequence = 0;
+static AudioLevels _levels = {};
+
+AudioInput::AudioInput(uint32_t adcPin)
+:   _fullBuffer(-1),
+    _worker([this]() { ProcessBuffer(); })
+{
+    ::_audioInput = this;
+
+    adc_init();
+    adc_gpio_init(adcPin);
+    adc_select_input(adcPin - 26);
+
+    // Every sample goes to the FIFO, raising a DMA request. Samples are left as 12 bits, without an error flag.
+    adc_fifo_setup(true, true, 1, false, false);
+    // The ADC clock is 48MHz, and a conversion takes one more cycle than the divider
+    adc_set_clkdiv(48000000.0f / AudioSampleRate - 1);
+
+    _dmaChannels[0] = dma_claim_unused_channel(true);
+    _dmaChannels[1] = dma_claim_unused_channel(true);
+    for(auto i = 0; i < 2; i++)
+    {
+        // Each channel fills its buffer, then starts the other channel, so there's no gap between blocks
+        auto config = dma_channel_get_default_config(_dmaChannels[i]);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_dreq(&config, DREQ_ADC);
+        channel_config_set_chain_to(&config, _dmaChannels[1 - i]);
+        dma_channel_configure(_dmaChannels[i], &config, _samples[i], &adc_hw->fifo, AudioFftSize, false);
+        dma_channel_set_irq1_enabled(_dmaChannels[i], true);
+    }
+
+    // The LED output owns DMA_IRQ_0
+    irq_add_shared_handler(DMA_IRQ_1, DmaCompleteHandler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    dma_channel_start(_dmaChannels[0]);
+    adc_run(true);
+    DBG_PRINT("Audio input started on GPIO %d\n", adcPin);
+}
+
+AudioInput::~AudioInput()
+{
+    adc_run(false);
+    for(auto channel : _dmaChannels)
+    {
+        dma_channel_set_irq1_enabled(channel, false);
+        dma_channel_abort(channel);
+        dma_channel_unclaim(channel);
+    }
+    irq_remove_handler(DMA_IRQ_1, DmaCompleteHandler);
+    adc_fifo_drain();
+
+    // Tell animations there's no audio any more
+    _levelsSequence = _levelsSequence + 1;
+    __dmb();
+    _levels = {};
+    __dmb();
+    _levelsSequence = _levelsSequence + 1;
+
+    ::_audioInput = nullptr;
+}
+
+void __isr AudioInput::DmaCompleteHandler()
+{
+    auto pThis = ::_audioInput;
+    if(!pThis)
+        return;
+
+    for(auto i = 0; i < 2; i++)
+    {
+        if(dma_channel_get_irq1_status(pThis->_dmaChannels[i]))
+        {
+            dma_channel_acknowledge_irq1(pThis->_dmaChannels[i]);
+            pThis->OnBufferFull(i);
+        }
+    }
+}
+
+void AudioInput::OnBufferFull(int buffer)
+{
+    // Rewind the finished channel, ready for the other one to chain back to it
+    dma_channel_set_write_addr(_dmaChannels[buffer], _samples[buffer], false);
+
+    _fullBuffer = buffer;
+    _worker.ScheduleWork();
+}
+
+void AudioInput::ProcessBuffer()
+{
+    auto buffer = _fullBuffer;
+    if(buffer < 0)
+        return;
+    _fullBuffer = -1;
+
+    // The DMA is filling the other buffer now, so this one is stable for the next 25ms
+    auto levels = _analyser.Process(_samples[buffer]);
+
+    _levelsSequence = _levelsSequence + 1;
+    __dmb();
+    _levels = levels;
+    __dmb();
+    _levelsSequence = _levelsSequence + 1;
+}
+
+bool ReadAudioLevels(AudioLevels &levels)
+{
+    uint32_t sequence = _levelsSequence;
+    if(sequence == 0 || (sequence & 1))
+        return false;
+
+    __dmb();
+    AudioLevels copy = _levels;
+    __dmb();
+    if(_levelsSequence != sequence)
+        return false;
+
+    levels = copy;
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include "AudioAnalyser.h"
+#include "scheduler.h"
+
+/// @brief Captures audio from a microphone on an ADC pin, and publishes band levels for animations
+/// @remarks Two chained DMA channels fill alternate sample buffers, so capture never stops. Each full buffer
+/// is analysed on core0 in the async context, and the levels are handed to core1 under a sequence count,
+/// so the animation loop never waits for audio.
+class AudioInput
+{
+public:
+    /// @param adcPin GPIO of the microphone, 26 to 28
+    AudioInput(uint32_t adcPin);
+    ~AudioInput();
+
+    AudioInput(const AudioInput &) = delete;
+    AudioInput &operator=(const AudioInput &) = delete;
+
+private:
+    static void DmaCompleteHandler();
+    void OnBufferFull(int buffer);
+    void ProcessBuffer();
+
+    int _dmaChannels[2];
+    uint16_t _samples[2][AudioFftSize];
+    volatile int _fullBuffer;   // Last buffer the DMA finished, or -1 once it's been processed
+
+    AudioAnalyser _analyser;
+    PendingWorker _worker;
+};
+
+/// @brief Gets the latest audio levels, for animations on core1
+/// @remarks A block lasts 25ms, so several frames read the same one. Check levels.block before acting on a beat.
+/// @return false if there's no audio input, or the levels were being updated. Keep using the previous levels.
+bool ReadAudioLevels(AudioLevels &levels);
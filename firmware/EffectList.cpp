@@ -0,0 +1,202 @@
+
+#include "mikuPixel.h"
+#include "EffectList.h"
+#include "deviceConfig.h"
+#include "bufferOutput.h"
+#include "EffectVm.h"
+#include <algorithm>
+#include <string.h>
+
+// Bytes of code returned by each part of the effect response, as two hex digits each
+static constexpr int CodeBytesPerPart = 32;
+
+EffectList::EffectList(std::shared_ptr<WebServer> webServer, std::shared_ptr<DeviceConfig> deviceConfig)
+:   _webServer(std::move(webServer)),
+    _deviceConfig(std::move(deviceConfig)),
+    _getEffect()
+{
+    _cgiHandlers.push_back(MakeCgiSubscription<int>(_webServer, "/api/effects/save.json", [this](const CgiParams &params) { return SaveEffect(params); }));
+    _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/effects/delete.json", [this](const CgiParams &params) { return DeleteEffect(params); }));
+    _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/effects/get.json", [this](const CgiParams &params) { return SaveGetParams(params); }));
+
+    _ssiHandlers.push_back(SsiSubscription(_webServer, "effects", [this](char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart) { return HandleEffectsResponse(pcInsert, iInsertLen, tagPart, nextPart); }));
+    _ssiHandlers.push_back(SsiSubscription(_webServer, "effect", [this](char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart) { return HandleEffectResponse(pcInsert, iInsertLen, tagPart, nextPart); }));
+}
+
+int16_t EffectList::HandleEffectsResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart)
+{
+    // Skip over the empty slots
+    auto effectId = tagPart;
+    const EffectConfig *effect = nullptr;
+    while(effectId < MAX_EFFECTS && !(effect = _deviceConfig->GetEffectConfig(effectId)))
+        effectId++;
+
+    if(!effect)
+        return 0; // No more effects
+
+    BufferOutput outputter(pcInsert, iInsertLen);
+    if(tagPart > 0)
+        outputter.Append(',');
+    outputter.Append("{ \"id\": ");
+    outputter.Append((int)effectId);
+    outputter.Append(", \"name\": \"");
+    outputter.AppendEscaped(effect->effectName);
+    outputter.Append("\", \"frameTime\": ");
+    outputter.Append((int)effect->frameTime);
+    outputter.Append(" }");
+
+    *nextPart = effectId + 1;
+    return outputter.BytesWritten();
+}
+
+int16_t EffectList::HandleEffectResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart)
+{
+    if(_getEffect == nullptr)
+    {
+        return 0; // Effect being read doesn't exist
+    }
+
+    BufferOutput outputter(pcInsert, iInsertLen);
+    if(tagPart == 0)
+    {
+        outputter.Append("{ \"name\": \"");
+        outputter.AppendEscaped(_getEffect->effectName);
+        outputter.Append("\", \"frameTime\": ");
+        outputter.Append((int)_getEffect->frameTime);
+        outputter.Append(", \"code\": \"");
+        *nextPart = tagPart + 1;
+        return outputter.BytesWritten();
+    }
+
+    constexpr char hexDigits[] = "0123456789abcdef";
+    auto start = (tagPart - 1) * CodeBytesPerPart;
+    auto end = std::min(start + CodeBytesPerPart, (int)_getEffect->codeLength);
+    for(auto i = start; i < end; i++)
+    {
+        outputter.Append(hexDigits[_getEffect->code[i] >> 4]);
+        outputter.Append(hexDigits[_getEffect->code[i] & 0xF]);
+    }
+
+    if(end < _getEffect->codeLength)
+    {
+        *nextPart = tagPart + 1;
+    }
+    else
+    {
+        outputter.Append("\" }");
+        _getEffect.reset();
+    }
+    return outputter.BytesWritten();
+}
+
+static int HexDigit(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int EffectList::SaveEffect(const CgiParams &params)
+{
+    auto effectName = params.find("name");
+    auto codeParam = params.find("code");
+    if(effectName == params.end() || codeParam == params.end())
+    {
+        DBG_PUT("Missing effect parameters!");
+        return -1;
+    }
+
+    int effectId = -1;
+    auto effectIdParam = params.find("id");
+    if(effectIdParam != params.end() && !effectIdParam->second.empty())
+    {
+        effectId = std::stoi(effectIdParam->second);
+    }
+    else
+    {
+        // New effect in the first free slot
+        for(auto i = 0; i < MAX_EFFECTS && effectId < 0; i++)
+        {
+            if(!_deviceConfig->GetEffectConfig(i))
+                effectId = i;
+        }
+    }
+    if(effectId < 0 || effectId >= MAX_EFFECTS)
+    {
+        DBG_PUT("No room for the effect");
+        return -1;
+    }
+
+    EffectConfig newConfig = {};
+    strlcpy(newConfig.effectName, effectName->second.c_str(), sizeof(newConfig.effectName));
+    newConfig.frameTime = 1000 / 30; // Default frame time
+    auto frameTimeParam = params.find("frameTime");
+    if(frameTimeParam != params.end() && !frameTimeParam->second.empty())
+    {
+        newConfig.frameTime = std::clamp(std::stoi(frameTimeParam->second), 1000 / 60, 60000);
+    }
+
+    const auto &hex = codeParam->second;
+    if(hex.length() % 2 || hex.length() / 2 > MaxEffectCodeLength)
+    {
+        DBG_PUT("Bad effect code length");
+        return -1;
+    }
+    for(size_t i = 0; i < hex.length(); i += 2)
+    {
+        auto high = HexDigit(hex[i]);
+        auto low = HexDigit(hex[i + 1]);
+        if(high < 0 || low < 0)
+        {
+            DBG_PUT("Bad effect code");
+            return -1;
+        }
+        newConfig.code[i / 2] = (high << 4) | low;
+    }
+    newConfig.codeLength = hex.length() / 2;
+
+    // Refuse programs that could misbehave, so what's in flash is always safe to run
+    if(!ValidateEffect(newConfig.code, newConfig.codeLength))
+    {
+        DBG_PUT("Effect failed validation");
+        return -1;
+    }
+
+    _deviceConfig->SaveEffectConfig(effectId, &newConfig);
+    return effectId;
+}
+
+bool EffectList::DeleteEffect(const CgiParams &params)
+{
+    auto effectIdParam = params.find("id");
+    if(effectIdParam == params.end())
+        return false;
+
+    auto effectId = std::stoi(effectIdParam->second);
+    if(effectId < 0 || !_deviceConfig->GetEffectConfig(effectId))
+        return false;
+
+    _deviceConfig->DeleteEffectConfig(effectId);
+    return true;
+}
+
+bool EffectList::SaveGetParams(const CgiParams &params)
+{
+    auto effectIdParam = params.find("id");
+    if(effectIdParam == params.end())
+        return false;
+    auto effectId = std::stoi(effectIdParam->second);
+
+    auto effect = effectId >= 0 ? _deviceConfig->GetEffectConfig(effectId) : nullptr;
+    if(!effect)
+    {
+        _getEffect.reset();
+        return false;
+    }
+    _getEffect = std::make_unique<EffectConfig>(*effect);
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <list>
+#include "webServer.h"
+
+class DeviceConfig;
+struct EffectConfig;
+
+// Web API for uploading user defined effect programs
+class EffectList
+{
+public:
+    EffectList(std::shared_ptr<WebServer> webServer, std::shared_ptr<DeviceConfig> deviceConfig);
+
+    // Disable copy constructor and assignment operator
+    EffectList(const EffectList &) = delete;
+    EffectList &operator=(const EffectList &) = delete;
+    EffectList(EffectList &&) = delete;
+    EffectList &operator=(EffectList &&) = delete;
+
+    ~EffectList() = default;
+
+private:
+    int16_t HandleEffectsResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart);
+    int16_t HandleEffectResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart);
+
+    int SaveEffect(const CgiParams &params);
+    bool DeleteEffect(const CgiParams &params);
+    bool SaveGetParams(const CgiParams &params);
+
+    std::list<SsiSubscription> _ssiHandlers;
+    std::list<CgiSubscription> _cgiHandlers;
+
+    std::unique_ptr<EffectConfig> _getEffect; // Copy of the effect being read by the API, as it's read over many calls
+
+    std::shared_ptr<WebServer> _webServer;
+    std::shared_ptr<DeviceConfig> _deviceConfig;
+};
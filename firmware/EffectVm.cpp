@@ -0,0 +1,290 @@
+#include "debugPrint.h"
+#include "EffectVm.h"
+#include <algorithm>
+#include <array>
+
+struct EffectOpInfo
+{
+    int8_t pops;        // -1 for an unknown opcode
+    int8_t pushes;
+    int8_t operandBytes;
+    uint8_t cost;       // Estimated cycles, including fetching and dispatching the instruction
+};
+
+using enum EffectOp;
+
+static constexpr std::array<EffectOpInfo, 256> BuildOpTable()
+{
+    std::array<EffectOpInfo, 256> table{};
+    for(auto &info : table)
+        info = { -1, 0, 0, 0 };
+    auto ops = [&table](EffectOp op) -> EffectOpInfo & { return table[(uint8_t)op]; };
+
+    // The dispatch is about 12 cycles on the Cortex-M0+. Division goes through the SIO hardware divider,
+    // and Hsv divides once as well as clamping its inputs.
+    ops(End) = { 0, 0, 0, 14 };
+    ops(Push8) = { 0, 1, 1, 18 };
+    ops(Push16) = { 0, 1, 2, 22 };
+    for(auto op : { Index, PosX, PosY, Segment, Time })
+        ops(op) = { 0, 1, 0, 16 };
+    ops(Dup) = { 1, 2, 0, 16 };
+    ops(Drop) = { 1, 0, 0, 14 };
+    ops(Swap) = { 2, 2, 0, 18 };
+    ops(Over) = { 2, 3, 0, 16 };
+    for(auto op : { Add, Sub, Mul, And, Or, Xor, Shl, Shr })
+        ops(op) = { 2, 1, 0, 19 };
+    for(auto op : { Min, Max, Lt, Gt, Eq })
+        ops(op) = { 2, 1, 0, 21 };
+    for(auto op : { Div, Mod })
+        ops(op) = { 2, 1, 0, 50 };
+    ops(Neg) = { 1, 1, 0, 16 };
+    ops(Not) = { 1, 1, 0, 18 };
+    ops(Sin) = { 1, 1, 0, 18 };
+    ops(Hsv) = { 3, 3, 0, 100 };
+    ops(Jz) = { 1, 0, 1, 22 };
+    ops(Jmp) = { 0, 0, 1, 18 };
+    return table;
+}
+
+static constexpr auto EffectOps = BuildOpTable();
+
+// Sine of a full turn in 256 steps, scaled to +-127
+static constexpr std::array<int8_t, 256> BuildSineTable()
+{
+    std::array<int8_t, 256> table{};
+    constexpr double pi = 3.14159265358979323846;
+    for(auto i = 0; i < 256; i++)
+    {
+        // Fold into -pi/2 to pi/2, where a short Taylor series is plenty accurate
+        double x = (i < 128 ? i : i - 256) * 2 * pi / 256;
+        if(x > pi / 2)
+            x = pi - x;
+        else if(x < -pi / 2)
+            x = -pi - x;
+        double x2 = x * x;
+        double s = x * (1 - x2 / 6 * (1 - x2 / 20 * (1 - x2 / 42 * (1 - x2 / 72))));
+        double scaled = s * 127;
+        table[i] = (int8_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    }
+    return table;
+}
+
+static constexpr auto SineTable = BuildSineTable();
+
+bool ValidateEffect(const uint8_t *code, size_t length)
+{
+    if(length == 0 || length > MaxEffectCodeLength)
+        return false;
+
+    // Stack depth on entry to each instruction, or -1 if not reached yet.
+    // Jumps only go forward, so one pass in order sees every way into an instruction before the instruction itself.
+    // Running off the end counts as an End.
+    std::array<int16_t, MaxEffectCodeLength + 1> depths;
+    std::array<bool, MaxEffectCodeLength + 1> isInstruction{};
+    depths.fill(-1);
+    depths[0] = 0;
+
+    auto reachEnd = [](int depth) { return depth >= 3; };
+    auto merge = [&depths](size_t target, int depth)
+    {
+        if(depths[target] >= 0 && depths[target] != depth)
+            return false;
+        depths[target] = depth;
+        return true;
+    };
+
+    for(size_t pc = 0; pc < length; )
+    {
+        isInstruction[pc] = true;
+        auto op = (EffectOp)code[pc];
+        auto &info = EffectOps[code[pc]];
+        if(info.pops < 0)
+        {
+            DBG_PRINT("Unknown effect opcode %02x at %d\n", code[pc], (int)pc);
+            return false;
+        }
+
+        auto next = pc + 1 + info.operandBytes;
+        if(next > length)
+            return false;
+
+        auto depth = depths[pc];
+        if(depth >= 0)
+        {
+            if(depth < info.pops)
+            {
+                DBG_PRINT("Effect stack underflow at %d\n", (int)pc);
+                return false;
+            }
+            auto after = depth - info.pops + info.pushes;
+            if(after > MaxEffectStackDepth)
+            {
+                DBG_PRINT("Effect stack overflow at %d\n", (int)pc);
+                return false;
+            }
+
+            if(op == End)
+            {
+                if(!reachEnd(depth))
+                    return false;
+            }
+            else
+            {
+                if(op == Jz || op == Jmp)
+                {
+                    auto target = next + code[pc + 1];
+                    if(target > length || !merge(target, after))
+                        return false;
+                }
+                if(op != Jmp && !merge(next, after))
+                    return false;
+            }
+        }
+        pc = next;
+    }
+
+    if(depths[length] >= 0 && !reachEnd(depths[length]))
+        return false;
+
+    // Jumps must land on the start of an instruction, including jumps in code that is never reached
+    isInstruction[length] = true;
+    for(size_t pc = 0; pc < length; pc += 1 + EffectOps[code[pc]].operandBytes)
+    {
+        auto op = (EffectOp)code[pc];
+        if((op == Jz || op == Jmp) && (pc + 2 + code[pc + 1] > length || !isInstruction[pc + 2 + code[pc + 1]]))
+        {
+            DBG_PRINT("Effect jump into an instruction at %d\n", (int)pc);
+            return false;
+        }
+    }
+
+    auto cost = EffectCost(code, length);
+    if(cost > MaxEffectCost)
+    {
+        DBG_PRINT("Effect is too slow, costing %d cycles a pixel\n", (int)cost);
+        return false;
+    }
+    return true;
+}
+
+uint32_t EffectCost(const uint8_t *code, size_t length)
+{
+    // Most expensive way into each instruction. As with the stack depths, one pass in order sees every way in.
+    std::array<uint32_t, MaxEffectCodeLength + 1> costs{};
+    std::array<bool, MaxEffectCodeLength + 1> reached{};
+    reached[0] = true;
+    uint32_t worst = 0;
+
+    auto reach = [&](size_t target, uint32_t cost)
+    {
+        reached[target] = true;
+        costs[target] = std::max(costs[target], cost);
+    };
+
+    for(size_t pc = 0; pc < length; )
+    {
+        auto op = (EffectOp)code[pc];
+        auto &info = EffectOps[code[pc]];
+        auto next = pc + 1 + info.operandBytes;
+        if(reached[pc])
+        {
+            auto after = costs[pc] + info.cost;
+            if(op == End)
+                worst = std::max(worst, after);
+            else
+            {
+                if(op == Jz || op == Jmp)
+                    reach(next + code[pc + 1], after);
+                if(op != Jmp)
+                    reach(next, after);
+            }
+        }
+        pc = next;
+    }
+
+    // Running off the end costs the same as an End
+    if(reached[length])
+        worst = std::max(worst, costs[length] + EffectOps[(uint8_t)End].cost);
+    return worst;
+}
+
+static inline void HsvToRgb(int32_t h, int32_t s, int32_t v, int32_t &r, int32_t &g, int32_t &b)
+{
+    h = std::clamp(h, 0, 255);
+    s = std::clamp(s, 0, 255);
+    v = std::clamp(v, 0, 255);
+
+    auto region = h / 43;
+    auto remainder = (h - region * 43) * 6;
+    auto p = (v * (255 - s)) >> 8;
+    auto q = (v * (255 - ((s * remainder) >> 8))) >> 8;
+    auto t = (v * (255 - ((s * (255 - remainder)) >> 8))) >> 8;
+    switch(region)
+    {
+        case 0: r = v; g = t; b = p; break;
+        case 1: r = q; g = v; b = p; break;
+        case 2: r = p; g = v; b = t; break;
+        case 3: r = p; g = q; b = v; break;
+        case 4: r = t; g = p; b = v; break;
+        default: r = v; g = p; b = q; break;
+    }
+}
+
+neopixel RunEffect(const uint8_t *code, size_t length, const EffectInputs &inputs)
+{
+    // Validation guarantees the stack stays within bounds, so there are no checks here
+    int32_t stack[MaxEffectStackDepth];
+    auto sp = stack;    // Next free entry
+
+    size_t pc = 0;
+    while(pc < length)
+    {
+        switch((EffectOp)code[pc++])
+        {
+            case End: pc = length; break;
+            case Push8: *sp++ = (int8_t)code[pc++]; break;
+            case Push16: *sp++ = (int16_t)(code[pc] | (code[pc + 1] << 8)); pc += 2; break;
+
+            case Index: *sp++ = inputs.index; break;
+            case PosX: *sp++ = inputs.x; break;
+            case PosY: *sp++ = inputs.y; break;
+            case Segment: *sp++ = inputs.segment; break;
+            case Time: *sp++ = inputs.time; break;
+
+            case Dup: sp[0] = sp[-1]; sp++; break;
+            case Drop: sp--; break;
+            case Swap: std::swap(sp[-1], sp[-2]); break;
+            case Over: sp[0] = sp[-2]; sp++; break;
+
+            // Wrap on overflow rather than relying on signed overflow
+            case Add: sp--; sp[-1] = (int32_t)((uint32_t)sp[-1] + (uint32_t)sp[0]); break;
+            case Sub: sp--; sp[-1] = (int32_t)((uint32_t)sp[-1] - (uint32_t)sp[0]); break;
+            case Mul: sp--; sp[-1] = (int32_t)((uint32_t)sp[-1] * (uint32_t)sp[0]); break;
+            case Div: sp--; sp[-1] = sp[0] == 0 ? 0 : sp[0] == -1 ? (int32_t)(0u - (uint32_t)sp[-1]) : sp[-1] / sp[0]; break;
+            case Mod: sp--; sp[-1] = sp[0] == 0 || sp[0] == -1 ? 0 : sp[-1] % sp[0]; break;
+            case Neg: sp[-1] = (int32_t)(0u - (uint32_t)sp[-1]); break;
+            case Min: sp--; sp[-1] = std::min(sp[-1], sp[0]); break;
+            case Max: sp--; sp[-1] = std::max(sp[-1], sp[0]); break;
+            case And: sp--; sp[-1] &= sp[0]; break;
+            case Or: sp--; sp[-1] |= sp[0]; break;
+            case Xor: sp--; sp[-1] ^= sp[0]; break;
+            case Shl: sp--; sp[-1] = (int32_t)((uint32_t)sp[-1] << (sp[0] & 31)); break;
+            case Shr: sp--; sp[-1] = sp[-1] >> (sp[0] & 31); break;
+            case Lt: sp--; sp[-1] = sp[-1] < sp[0]; break;
+            case Gt: sp--; sp[-1] = sp[-1] > sp[0]; break;
+            case Eq: sp--; sp[-1] = sp[-1] == sp[0]; break;
+            case Not: sp[-1] = !sp[-1]; break;
+
+            case Sin: sp[-1] = SineTable[sp[-1] & 0xFF]; break;
+            case Hsv: HsvToRgb(sp[-3], sp[-2], sp[-1], sp[-3], sp[-2], sp[-1]); break;
+
+            case Jz: sp--; pc = sp[0] == 0 ? pc + 1 + code[pc] : pc + 1; break;
+            case Jmp: pc += 1 + code[pc]; break;
+        }
+    }
+
+    return neopixel(
+        std::clamp(sp[-3], 0, 255),
+        std::clamp(sp[-2], 0, 255),
+        std::clamp(sp[-1], 0, 255));
+}
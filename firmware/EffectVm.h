@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "NeoPixel.h"
+
+// A tiny stack machine for user defined effects, uploaded through the web API and stored in flash.
+// A program runs once per pixel, and leaves the red, green and blue of the pixel on the top of the stack.
+// Jumps can only go forwards, so a program runs at most one instruction per byte of code.
+//
+// That alone would still allow far too much work per frame, so programs are also limited by how long they take.
+// Each instruction has an estimated cost in cycles of the 125 MHz RP2040, including the interpreter's dispatch, and
+// the most expensive path through a program must fit in MaxEffectCost. Running that on every pixel, along with
+// EffectPixelCost for the loop around it, fits in EffectFrameBudget: 8 ms, half of the fastest frame.
+
+constexpr size_t MaxEffectCodeLength = 256;
+constexpr int MaxEffectStackDepth = 16;
+constexpr uint32_t EffectFrameBudget = 125 * 8000;
+constexpr uint32_t EffectPixelCost = 150;
+constexpr uint32_t MaxEffectCost = 2800;
+
+enum class EffectOp : uint8_t
+{
+    End = 0x00,         // Stop. The top three values are the red, green and blue of the pixel.
+    Push8 = 0x01,       // Push a signed byte
+    Push16 = 0x02,      // Push a signed 16 bit value, little endian
+
+    // Inputs
+    Index = 0x10,       // Pixel index, 0 to PIXEL_COUNT - 1
+    PosX = 0x11,        // Position of the pixel, 0 to 126
+    PosY = 0x12,
+    Segment = 0x13,     // Index of the part of Miku in mikuParts
+    Time = 0x14,        // Frame counter
+
+    // Stack
+    Dup = 0x20,
+    Drop = 0x21,
+    Swap = 0x22,
+    Over = 0x23,
+
+    // Arithmetic, popping b then a and pushing a op b. Division by zero gives zero.
+    Add = 0x30,
+    Sub = 0x31,
+    Mul = 0x32,
+    Div = 0x33,
+    Mod = 0x34,
+    Neg = 0x35,
+    Min = 0x36,
+    Max = 0x37,
+    And = 0x38,
+    Or = 0x39,
+    Xor = 0x3A,
+    Shl = 0x3B,
+    Shr = 0x3C,
+    Lt = 0x3D,
+    Gt = 0x3E,
+    Eq = 0x3F,
+    Not = 0x40,
+
+    // Colour helpers
+    Sin = 0x50,         // Angle 0-255 for a full turn, giving -127 to 127
+    Hsv = 0x51,         // Hue, saturation and value 0-255, giving red, green and blue
+
+    // Control. The offset is an unsigned byte, counted from the end of the jump instruction.
+    Jz = 0x60,          // Pop, and jump if zero
+    Jmp = 0x61
+};
+
+/// @brief Inputs to the program for one pixel
+struct EffectInputs
+{
+    int32_t index;
+    int32_t x;
+    int32_t y;
+    int32_t segment;
+    int32_t time;
+};
+
+/// @brief Checks a program can't misbehave: every instruction is known, jumps go forward onto an instruction,
+/// the stack never underflows or overflows, it always finishes with a colour on the stack, and it fits in MaxEffectCost.
+bool ValidateEffect(const uint8_t *code, size_t length);
+
+/// @brief Estimated cost of the most expensive path through a program, in cycles
+/// @remarks Only for programs that pass the other checks of ValidateEffect, as it doesn't check the jumps
+uint32_t EffectCost(const uint8_t *code, size_t length);
+
+/// @brief Runs a validated program for one pixel
+neopixel RunEffect(const uint8_t *code, size_t length, const EffectInputs &inputs);
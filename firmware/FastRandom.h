@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include "pico/rand.h"
+
+/// @brief Tiny xorshift32 random number generator for animations
+/// @remarks Each animation owns its own generator, so core1 never touches newlib's shared rand() state,
+/// and an animation seeded with a fixed value will always draw the same frames.
+class FastRandom
+{
+public:
+    /// @param seed Starting state. 0 seeds from the hardware random source (ROSC and friends)
+    explicit FastRandom(uint32_t seed = 0)
+    {
+        Seed(seed);
+    }
+
+    void Seed(uint32_t seed)
+    {
+        if(seed == 0)
+            seed = get_rand_32();
+        // xorshift gets stuck on zero
+        _state = seed ? seed : 0x6d696b75;
+    }
+
+    uint32_t Next()
+    {
+        _state ^= _state << 13;
+        _state ^= _state >> 17;
+        _state ^= _state << 5;
+        return _state;
+    }
+
+    /// @brief Random number from 0 to limit - 1
+    uint32_t Below(uint32_t limit)
+    {
+        return Next() % limit;
+    }
+
+private:
+    uint32_t _state;
+};
@@ -1,11 +1,39 @@
 #pragma once
 
 #include "pico/stdlib.h"
+#include <span>
 
 class NeoPixelFrame;
 
+enum class ParameterType
+{
+    Integer,
+    Boolean
+};
+
+/// @brief Description of a value that can be changed while an animation is running
+struct AnimationParameter
+{
+    const char *name;
+    ParameterType type;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t defaultValue;
+};
+
 class IAnimation
 {
 public:
+    virtual ~IAnimation() = default;
+
     virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) = 0;
+
+    // Live tuning. These are called from core0 while core1 is drawing frames.
+
+    /// @brief Parameters the animation supports, indexed the same as GetParameter and SetParameter
+    virtual std::span<const AnimationParameter> GetParameters() const { return {}; }
+    virtual int32_t GetParameter(int index) const { return 0; }
+    /// @brief Changes a parameter, taking effect from the start of the next frame
+    /// @return false if there is no such parameter. Out of range values are clamped.
+    virtual bool SetParameter(int index, int32_t value) { return false; }
 };
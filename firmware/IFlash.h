@@ -0,0 +1,36 @@
+// Copyright (c) 2025 Mark Godwin.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// @brief The flash operations BlockStorage is built on, so it can be run against a simulated flash off the device
+/// @remarks Offsets are from the start of the flash, and must be page or sector aligned as for the SDK flash functions.
+/// Program and Erase return Ok on success, or a negative error code.
+class IFlash
+{
+public:
+    virtual ~IFlash() = default;
+
+    // Results of Program and Erase. Ok is the same as the SDK's PICO_OK, so its errors can be passed straight through.
+    static constexpr int Ok = 0;
+    static constexpr int Failed = -1;
+
+    static constexpr uint32_t PageSize = 256;
+    static constexpr uint32_t SectorSize = 4096;
+
+    // Rough worst case times for flash writes, in microseconds
+    static constexpr uint32_t PageProgramTime = 1000;
+    static constexpr uint32_t SectorEraseTime = 50000;
+
+    /// @brief Where the flash at an offset can be read directly
+    virtual const uint8_t *Map(uint32_t offset) const = 0;
+
+    /// @brief Programs whole pages. Like the real flash, this can only clear bits, so the pages should be erased first.
+    virtual int Program(uint32_t offset, const uint8_t *data, size_t size) = 0;
+
+    /// @brief Erases whole sectors, back to all 0xFF
+    virtual int Erase(uint32_t offset, size_t size) = 0;
+};
@@ -3,6 +3,7 @@
 #include "LightController.h"
 
 #include "MikuLight.h"
+#include "AnimationRegistry.h"
 
 LightController::LightController(
     std::shared_ptr<MikuLight> mikuLight,
@@ -18,8 +19,12 @@ LightController::LightController(
     _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/setBrightness.json", [this](const CgiParams &params) { return OnSetBrightnessCgi(params); }));
     _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/activatePattern.json", [this](const CgiParams &params) { return ActivatePatternCgi(params); }));
     _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/activateAnimation.json", [this](const CgiParams &params) { return ActivateAnimationCgi(params); }));
+    _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/activateEffect.json", [this](const CgiParams &params) { return ActivateEffectCgi(params); }));
+    _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/activateZoneAnimation.json", [this](const CgiParams &params) { return ActivateZoneAnimationCgi(params); }));
+    _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/animations/setParameter.json", [this](const CgiParams &params) { return SetParameterCgi(params); }));
 
     _ssiHandlers.push_back(SsiSubscription(_webServer, "anims", [this](char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart) { return HandleAnimationsResponse(pcInsert, iInsertLen, tagPart, nextPart); }));
+    _ssiHandlers.push_back(SsiSubscription(_webServer, "params", [this](char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart) { return HandleParametersResponse(pcInsert, iInsertLen, tagPart, nextPart); }));
 
     DBG_PUT("Registering Light MQTT handlers 1\n");
 
@@ -42,6 +47,9 @@ LightController::LightController(
     _mqttHandlers.push_back(MqttSubscription(_mqttClient, string_format("miku/%s/fx/cmd", macAddress), [this](const uint8_t *payload, uint32_t length)
                  { OnEffectCommand(payload, length); })
     );
+    _mqttHandlers.push_back(MqttSubscription(_mqttClient, string_format("miku/%s/param/cmd", macAddress), [this](const uint8_t *payload, uint32_t length)
+                 { OnParameterCommand(payload, length); })
+    );
 
 }
 
@@ -100,14 +108,52 @@ bool LightController::ActivateAnimationCgi(const CgiParams &params)
             return false;
 
         const auto &name = animationName->second;
-        animationId = _mikuLight->GetAnimationByName(name);
+        animationId = FindAnimation(name);
         if(animationId < 0)
+        {
+            DBG_PRINT("Unknown effect name: %s", name.c_str());
             return false;
+        }
     }
 
     return _mikuLight->StartAnimation(animationId);
 }
 
+bool LightController::ActivateEffectCgi(const CgiParams &params)
+{
+    auto effectId = params.find("id");
+    if(effectId == params.end())
+        return false;
+
+    return _mikuLight->ActivateEffect(std::stoi(effectId->second));
+}
+
+bool LightController::ActivateZoneAnimationCgi(const CgiParams &params)
+{
+    auto zoneParam = params.find("zone");
+    auto animationIdParam = params.find("id");
+    if(zoneParam == params.end() || animationIdParam == params.end())
+        return false;
+
+    auto zone = std::stoi(zoneParam->second);
+    auto animationId = std::stoi(animationIdParam->second);
+    return _mikuLight->StartZoneAnimation(zone, animationId);
+}
+
+bool LightController::SetParameterCgi(const CgiParams &params)
+{
+    auto idParam = params.find("id");
+    auto valueParam = params.find("value");
+    if(idParam == params.end() || valueParam == params.end())
+        return false;
+
+    auto animation = _mikuLight->GetAnimation();
+    if(!animation)
+        return false;
+
+    return animation->SetParameter(std::stoi(idParam->second), std::stoi(valueParam->second));
+}
+
 void LightController::OnSwitchCommand(const uint8_t *payload, uint32_t length)
 {
     // Expecting a string payload like "ON" or "OFF"
@@ -178,19 +224,48 @@ void LightController::OnWhiteCommand(const uint8_t *payload, uint32_t length)
 void LightController::OnEffectCommand(const uint8_t *payload, uint32_t length)
 {
     // Expecting a string payload like "solid"
-    std::string effectName;
-    effectName.resize(length);
-    memcpy(effectName.data(), payload, length);
+    std::string_view effectName((const char *)payload, length);
 
-    auto animationId = _mikuLight->GetAnimationByName(effectName);
+    auto animationId = FindAnimation(effectName);
     if(animationId >= 0)
         _mikuLight->StartAnimation(animationId);
+    else
+        DBG_PRINT("Unknown effect name: %.*s\n", length, payload);
 }
 
 
+// Sets one parameter of the running animation
+void LightController::OnParameterCommand(const uint8_t *payload, uint32_t length)
+{
+    // Expecting a non-terminated string payload like "speed=8"
+    std::string_view command((const char *)payload, length);
+    auto equals = command.find('=');
+    if(equals == std::string_view::npos)
+    {
+        DBG_PRINT("Invalid parameter command: %.*s\n", length, payload);
+        return;
+    }
+
+    auto animation = _mikuLight->GetAnimation();
+    if(!animation)
+        return;
+
+    auto name = command.substr(0, equals);
+    auto parameters = animation->GetParameters();
+    auto parameter = std::find_if(parameters.begin(), parameters.end(), [name](const AnimationParameter &p) { return name == p.name; });
+    if(parameter == parameters.end())
+    {
+        DBG_PRINT("Unknown parameter: %.*s\n", length, payload);
+        return;
+    }
+
+    auto value = std::stoi(std::string(command.substr(equals + 1)));
+    animation->SetParameter(parameter - parameters.begin(), value);
+}
+
 int16_t LightController::HandleAnimationsResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart)
 {
-    const auto &animations = _mikuLight->GetAvailableAnimations();
+    auto animations = GetAnimations();
 
     if(tagPart == 0)
     {
@@ -202,13 +277,13 @@ int16_t LightController::HandleAnimationsResponse(char *pcInsert, int iInsertLen
         return 0; // No more patterns
     }
 
-    const auto &[shortName, animationName] = animations[tagPart];
+    const auto &animation = animations[tagPart];
 
     BufferOutput outputter(pcInsert, iInsertLen);
     outputter.Append("{ \"id\": ");
     outputter.Append((int)tagPart);
     outputter.Append(", \"name\": \"");
-    outputter.AppendEscaped(animationName.c_str());
+    outputter.AppendEscaped(animation.description);
     outputter.Append("\" ");
 
     if(tagPart + 1 < animations.size())
@@ -223,3 +298,42 @@ int16_t LightController::HandleAnimationsResponse(char *pcInsert, int iInsertLen
 }
 
 
+
+int16_t LightController::HandleParametersResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart)
+{
+    auto animation = _mikuLight->GetAnimation();
+    if(!animation)
+        return 0;
+
+    auto parameters = animation->GetParameters();
+    if(tagPart >= parameters.size())
+    {
+        return 0; // No more parameters
+    }
+
+    const auto &parameter = parameters[tagPart];
+
+    BufferOutput outputter(pcInsert, iInsertLen);
+    outputter.Append("{ \"id\": ");
+    outputter.Append((int)tagPart);
+    outputter.Append(", \"name\": \"");
+    outputter.AppendEscaped(parameter.name);
+    outputter.Append("\", \"type\": \"");
+    outputter.Append(parameter.type == ParameterType::Boolean ? "bool" : "int");
+    outputter.Append("\", \"min\": ");
+    outputter.Append((int)parameter.minimum);
+    outputter.Append(", \"max\": ");
+    outputter.Append((int)parameter.maximum);
+    outputter.Append(", \"value\": ");
+    outputter.Append((int)animation->GetParameter(tagPart));
+
+    if(tagPart + 1 < parameters.size())
+    {
+        outputter.Append(" },");
+        *nextPart = tagPart + 1;
+    }
+    else
+        outputter.Append(" }");
+
+    return outputter.BytesWritten();
+}
@@ -22,6 +22,9 @@ private:
     bool OnSetBrightnessCgi(const CgiParams &params);
     bool ActivatePatternCgi(const CgiParams &params);
     bool ActivateAnimationCgi(const CgiParams &params);
+    bool ActivateEffectCgi(const CgiParams &params);
+    bool ActivateZoneAnimationCgi(const CgiParams &params);
+    bool SetParameterCgi(const CgiParams &params);
 
     void OnSwitchCommand(const uint8_t *payload, uint32_t length);
     void OnBrightnessCommand(const uint8_t *payload, uint32_t length);
@@ -32,8 +35,10 @@ private:
     std::tuple<float,float,int> RGBtoHSB(int red, int green, int blue);
 
     void OnEffectCommand(const uint8_t *payload, uint32_t length);
+    void OnParameterCommand(const uint8_t *payload, uint32_t length);
 
     int16_t HandleAnimationsResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart);
+    int16_t HandleParametersResponse(char *pcInsert, int iInsertLen, uint16_t tagPart, uint16_t *nextPart);
 
     std::shared_ptr<MikuLight> _mikuLight;
     std::shared_ptr<WebServer> _webServer;
@@ -1,339 +1,6 @@
-
 #include "Miku.h"
 
 // Shared
 neopixel GridBuffer[127][127];
 
-const PositionMapping PixelPositions[] = {
-    {101, 42},
-    {101, 45},
-    {101, 48},
-    {100, 51},
-    {100, 54},
-    {99, 57},
-    {99, 60},
-    {98, 63},
-    {97, 66},
-    {96, 69},
-    {95, 72},
-    {95, 74},
-    {96, 95},
-    {97, 97},
-    {97, 100},
-    {96, 102},
-    {95, 105},
-    {93, 108},
-    {92, 110},
-    {90, 112},
-    {88, 113},
-    {86, 113},
-    {85, 110},
-    {86, 107},
-    {88, 105},
-    {89, 103},
-    {90, 100},
-    {91, 98},
-    {98, 110},
-    {101, 109},
-    {103, 107},
-    {104, 104},
-    {105, 101},
-    {106, 99},
-    {107, 95},
-    {108, 93},
-    {108, 90},
-    {109, 86},
-    {110, 84},
-    {111, 81},
-    {112, 78},
-    {113, 75},
-    {114, 72},
-    {116, 69},
-    {118, 67},
-    {119, 64},
-    {120, 61},
-    {122, 59},
-    {124, 56},
-    {125, 53},
-    {126, 50},
-    {127, 47},
-    {127, 44},
-    {126, 41},
-    {124, 40},
-    {121, 40},
-    {119, 43},
-    {117, 45},
-    {116, 46},
-    {113, 47},
-    {111, 45},
-    {110, 43},
-    {110, 41},
-    {110, 38},
-    {110, 35},
-    {111, 32},
-    {110, 28},
-    {109, 25},
-    {107, 24},
-    {105, 24},
-    {82, 35},
-    {84, 33},
-    {86, 31},
-    {88, 29},
-    {90, 26},
-    {93, 25},
-    {96, 25},
-    {98, 27},
-    {100, 29},
-    {101, 32},
-    {100, 35},
-    {98, 37},
-    {95, 38},
-    {93, 40},
-    {90, 41},
-    {88, 43},
-    {85, 46},
-    {83, 48},
-    {81, 50},
-    {79, 52},
-    {77, 52},
-    {75, 50},
-    {76, 48},
-    {76, 45},
-    {77, 43},
-    {77, 39},
-    {78, 36},
-    {79, 33},
-    {81, 30},
-    {83, 27},
-    {84, 25},
-    {85, 22},
-    {85, 19},
-    {84, 17},
-    {82, 15},
-    {79, 14},
-    {76, 13},
-    {73, 13},
-    {70, 15},
-    {68, 16},
-    {66, 18},
-    {64, 18},
-    {62, 16},
-    {60, 14},
-    {57, 13},
-    {55, 13},
-    {52, 14},
-    {49, 15},
-    {47, 16},
-    {45, 18},
-    {45, 21},
-    {45, 24},
-    {47, 26},
-    {48, 29},
-    {50, 32},
-    {51, 35},
-    {51, 38},
-    {52, 41},
-    {52, 44},
-    {53, 47},
-    {53, 50},
-    {52, 52},
-    {49, 51},
-    {47, 49},
-    {45, 47},
-    {43, 45},
-    {41, 42},
-    {39, 40},
-    {36, 39},
-    {34, 37},
-    {32, 35},
-    {29, 33},
-    {29, 30},
-    {30, 28},
-    {31, 26},
-    {34, 24},
-    {37, 23},
-    {40, 25},
-    {41, 27},
-    {43, 29},
-    {45, 32},
-    {47, 34},
-    {60, 52},
-    {61, 50},
-    {62, 47},
-    {62, 44},
-    {62, 41},
-    {61, 38},
-    {60, 35},
-    {60, 32},
-    {61, 29},
-    {62, 27},
-    {65, 26},
-    {68, 27},
-    {69, 30},
-    {69, 33},
-    {68, 36},
-    {68, 39},
-    {67, 42},
-    {66, 45},
-    {67, 48},
-    {67, 50},
-    {69, 53},
-    {83, 67},
-    {82, 66},
-    {80, 63},
-    {78, 61},
-    {75, 60},
-    {72, 59},
-    {69, 59},
-    {65, 58},
-    {63, 58},
-    {60, 58},
-    {56, 59},
-    {53, 59},
-    {51, 60},
-    {48, 62},
-    {46, 64},
-    {45, 66},
-    {29, 94},
-    {28, 97},
-    {29, 99},
-    {29, 102},
-    {30, 105},
-    {32, 107},
-    {33, 110},
-    {35, 112},
-    {38, 113},
-    {40, 112},
-    {40, 109},
-    {39, 106},
-    {38, 104},
-    {36, 102},
-    {35, 99},
-    {41, 72},
-    {39, 70},
-    {37, 72},
-    {35, 74},
-    {34, 77},
-    {34, 80},
-    {34, 83},
-    {34, 86},
-    {34, 89},
-    {35, 92},
-    {36, 95},
-    {37, 97},
-    {39, 100},
-    {40, 102},
-    {42, 105},
-    {44, 106},
-    {47, 109},
-    {49, 110},
-    {52, 111},
-    {55, 112},
-    {57, 113},
-    {61, 114},
-    {64, 114},
-    {68, 114},
-    {70, 113},
-    {73, 113},
-    {76, 111},
-    {79, 110},
-    {81, 109},
-    {84, 106},
-    {85, 104},
-    {87, 102},
-    {89, 99},
-    {90, 96},
-    {91, 93},
-    {92, 91},
-    {93, 88},
-    {93, 85},
-    {93, 82},
-    {92, 79},
-    {92, 76},
-    {91, 74},
-    {89, 72},
-    {86, 72},
-    {85, 74},
-    {83, 77},
-    {82, 79},
-    {81, 82},
-    {80, 85},
-    {78, 87},
-    {77, 90},
-    {75, 92},
-    {72, 93},
-    {70, 93},
-    {69, 91},
-    {68, 89},
-    {69, 87},
-    {69, 84},
-    {68, 81},
-    {66, 81},
-    {63, 82},
-    {62, 84},
-    {60, 87},
-    {59, 90},
-    {58, 92},
-    {57, 93},
-    {54, 94},
-    {52, 93},
-    {50, 91},
-    {48, 88},
-    {47, 85},
-    {45, 83},
-    {44, 80},
-    {31, 67},
-    {31, 65},
-    {30, 61},
-    {29, 59},
-    {28, 55},
-    {28, 53},
-    {28, 50},
-    {27, 46},
-    {27, 43},
-    {27, 41},
-    {25, 23},
-    {22, 23},
-    {20, 24},
-    {18, 27},
-    {17, 30},
-    {17, 33},
-    {17, 36},
-    {16, 39},
-    {15, 41},
-    {13, 42},
-    {10, 41},
-    {9, 39},
-    {7, 37},
-    {5, 35},
-    {3, 35},
-    {1, 37},
-    {0, 40},
-    {1, 43},
-    {1, 47},
-    {2, 49},
-    {4, 52},
-    {5, 55},
-    {6, 58},
-    {8, 60},
-    {9, 63},
-    {11, 66},
-    {12, 68},
-    {13, 71},
-    {14, 74},
-    {15, 77},
-    {16, 80},
-    {17, 83},
-    {17, 86},
-    {18, 89},
-    {18, 91},
-    {19, 95},
-    {20, 97},
-    {20, 100},
-    {22, 103},
-    {23, 106},
-    {26, 108},
-    {27, 109},
-};
-
 // Maps out connections between all of the runs of Miku:
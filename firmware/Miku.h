@@ -118,27 +118,362 @@ constexpr const MikuPart *AggregatedMikuParts[] = {
     MikuShirtAndTie
 };
 
-extern PositionMapping const PixelPositions[PIXEL_COUNT];
 extern neopixel GridBuffer[127][127]; // For intermediate drawing before pixel mapping
 
+// Position of each pixel in the 127x127 drawing grid
+inline constexpr PositionMapping PixelPositions[PIXEL_COUNT] = {
+    {101, 42},
+    {101, 45},
+    {101, 48},
+    {100, 51},
+    {100, 54},
+    {99, 57},
+    {99, 60},
+    {98, 63},
+    {97, 66},
+    {96, 69},
+    {95, 72},
+    {95, 74},
+    {96, 95},
+    {97, 97},
+    {97, 100},
+    {96, 102},
+    {95, 105},
+    {93, 108},
+    {92, 110},
+    {90, 112},
+    {88, 113},
+    {86, 113},
+    {85, 110},
+    {86, 107},
+    {88, 105},
+    {89, 103},
+    {90, 100},
+    {91, 98},
+    {98, 110},
+    {101, 109},
+    {103, 107},
+    {104, 104},
+    {105, 101},
+    {106, 99},
+    {107, 95},
+    {108, 93},
+    {108, 90},
+    {109, 86},
+    {110, 84},
+    {111, 81},
+    {112, 78},
+    {113, 75},
+    {114, 72},
+    {116, 69},
+    {118, 67},
+    {119, 64},
+    {120, 61},
+    {122, 59},
+    {124, 56},
+    {125, 53},
+    {126, 50},
+    {127, 47},
+    {127, 44},
+    {126, 41},
+    {124, 40},
+    {121, 40},
+    {119, 43},
+    {117, 45},
+    {116, 46},
+    {113, 47},
+    {111, 45},
+    {110, 43},
+    {110, 41},
+    {110, 38},
+    {110, 35},
+    {111, 32},
+    {110, 28},
+    {109, 25},
+    {107, 24},
+    {105, 24},
+    {82, 35},
+    {84, 33},
+    {86, 31},
+    {88, 29},
+    {90, 26},
+    {93, 25},
+    {96, 25},
+    {98, 27},
+    {100, 29},
+    {101, 32},
+    {100, 35},
+    {98, 37},
+    {95, 38},
+    {93, 40},
+    {90, 41},
+    {88, 43},
+    {85, 46},
+    {83, 48},
+    {81, 50},
+    {79, 52},
+    {77, 52},
+    {75, 50},
+    {76, 48},
+    {76, 45},
+    {77, 43},
+    {77, 39},
+    {78, 36},
+    {79, 33},
+    {81, 30},
+    {83, 27},
+    {84, 25},
+    {85, 22},
+    {85, 19},
+    {84, 17},
+    {82, 15},
+    {79, 14},
+    {76, 13},
+    {73, 13},
+    {70, 15},
+    {68, 16},
+    {66, 18},
+    {64, 18},
+    {62, 16},
+    {60, 14},
+    {57, 13},
+    {55, 13},
+    {52, 14},
+    {49, 15},
+    {47, 16},
+    {45, 18},
+    {45, 21},
+    {45, 24},
+    {47, 26},
+    {48, 29},
+    {50, 32},
+    {51, 35},
+    {51, 38},
+    {52, 41},
+    {52, 44},
+    {53, 47},
+    {53, 50},
+    {52, 52},
+    {49, 51},
+    {47, 49},
+    {45, 47},
+    {43, 45},
+    {41, 42},
+    {39, 40},
+    {36, 39},
+    {34, 37},
+    {32, 35},
+    {29, 33},
+    {29, 30},
+    {30, 28},
+    {31, 26},
+    {34, 24},
+    {37, 23},
+    {40, 25},
+    {41, 27},
+    {43, 29},
+    {45, 32},
+    {47, 34},
+    {60, 52},
+    {61, 50},
+    {62, 47},
+    {62, 44},
+    {62, 41},
+    {61, 38},
+    {60, 35},
+    {60, 32},
+    {61, 29},
+    {62, 27},
+    {65, 26},
+    {68, 27},
+    {69, 30},
+    {69, 33},
+    {68, 36},
+    {68, 39},
+    {67, 42},
+    {66, 45},
+    {67, 48},
+    {67, 50},
+    {69, 53},
+    {83, 67},
+    {82, 66},
+    {80, 63},
+    {78, 61},
+    {75, 60},
+    {72, 59},
+    {69, 59},
+    {65, 58},
+    {63, 58},
+    {60, 58},
+    {56, 59},
+    {53, 59},
+    {51, 60},
+    {48, 62},
+    {46, 64},
+    {45, 66},
+    {29, 94},
+    {28, 97},
+    {29, 99},
+    {29, 102},
+    {30, 105},
+    {32, 107},
+    {33, 110},
+    {35, 112},
+    {38, 113},
+    {40, 112},
+    {40, 109},
+    {39, 106},
+    {38, 104},
+    {36, 102},
+    {35, 99},
+    {41, 72},
+    {39, 70},
+    {37, 72},
+    {35, 74},
+    {34, 77},
+    {34, 80},
+    {34, 83},
+    {34, 86},
+    {34, 89},
+    {35, 92},
+    {36, 95},
+    {37, 97},
+    {39, 100},
+    {40, 102},
+    {42, 105},
+    {44, 106},
+    {47, 109},
+    {49, 110},
+    {52, 111},
+    {55, 112},
+    {57, 113},
+    {61, 114},
+    {64, 114},
+    {68, 114},
+    {70, 113},
+    {73, 113},
+    {76, 111},
+    {79, 110},
+    {81, 109},
+    {84, 106},
+    {85, 104},
+    {87, 102},
+    {89, 99},
+    {90, 96},
+    {91, 93},
+    {92, 91},
+    {93, 88},
+    {93, 85},
+    {93, 82},
+    {92, 79},
+    {92, 76},
+    {91, 74},
+    {89, 72},
+    {86, 72},
+    {85, 74},
+    {83, 77},
+    {82, 79},
+    {81, 82},
+    {80, 85},
+    {78, 87},
+    {77, 90},
+    {75, 92},
+    {72, 93},
+    {70, 93},
+    {69, 91},
+    {68, 89},
+    {69, 87},
+    {69, 84},
+    {68, 81},
+    {66, 81},
+    {63, 82},
+    {62, 84},
+    {60, 87},
+    {59, 90},
+    {58, 92},
+    {57, 93},
+    {54, 94},
+    {52, 93},
+    {50, 91},
+    {48, 88},
+    {47, 85},
+    {45, 83},
+    {44, 80},
+    {31, 67},
+    {31, 65},
+    {30, 61},
+    {29, 59},
+    {28, 55},
+    {28, 53},
+    {28, 50},
+    {27, 46},
+    {27, 43},
+    {27, 41},
+    {25, 23},
+    {22, 23},
+    {20, 24},
+    {18, 27},
+    {17, 30},
+    {17, 33},
+    {17, 36},
+    {16, 39},
+    {15, 41},
+    {13, 42},
+    {10, 41},
+    {9, 39},
+    {7, 37},
+    {5, 35},
+    {3, 35},
+    {1, 37},
+    {0, 40},
+    {1, 43},
+    {1, 47},
+    {2, 49},
+    {4, 52},
+    {5, 55},
+    {6, 58},
+    {8, 60},
+    {9, 63},
+    {11, 66},
+    {12, 68},
+    {13, 71},
+    {14, 74},
+    {15, 77},
+    {16, 80},
+    {17, 83},
+    {17, 86},
+    {18, 89},
+    {18, 91},
+    {19, 95},
+    {20, 97},
+    {20, 100},
+    {22, 103},
+    {23, 106},
+    {26, 108},
+    {27, 109},
+};
+
 struct Connection {
-    int track;
-    bool start; // True if connection is at start of track, false if at end
+    int track = -1;
+    bool start = false; // True if connection is at start of track, false if at end
 };
 
 constexpr Connection NullConnection{ -1, false };
 
+// Most tracks that can meet at the end of another track. Connection lists are terminated by NullConnection
+constexpr size_t MaxTrackConnections = 3;
+
 struct TrackPart {
     int start;
     int end;
-    std::array<Connection, 3> startConnections;
-    std::array<Connection, 3> endConnections;
+    std::array<Connection, MaxTrackConnections + 1> startConnections;
+    std::array<Connection, MaxTrackConnections + 1> endConnections;
 
-    bool IsAtEnd(int position, int direction) const
+    constexpr bool IsAtEnd(int position, int direction) const
     {
         return (direction > 0 && position == end) || (direction < 0 && position == start);
     }
-    const Connection* GetConnections(bool atEnd) const
+    constexpr const Connection* GetConnections(bool atEnd) const
     {
         return atEnd ? endConnections.data() : startConnections.data();
     }
@@ -156,7 +491,7 @@ inline constexpr auto MikuTracks = std::to_array<TrackPart>({
     TrackPart { 78, 80, { Connection { 3, false },Connection { 16, false}, NullConnection }, { Connection { 0, true },Connection { 8, true}, NullConnection } },
     TrackPart { 81, 90, { Connection { 0, true },Connection { 7, false}, NullConnection }, { Connection { 9, true },Connection { 22, false}, NullConnection } },
     TrackPart { 91, 95, { Connection { 8, false },Connection { 22, false}, NullConnection }, { Connection { 16, true },Connection { 10, true}, NullConnection } },
-    TrackPart { 96, 110, { Connection { 9, false}, NullConnection }, { Connection { 10, false },Connection { 20, false}, NullConnection } },
+    TrackPart { 96, 110, { Connection { 9, false}, NullConnection }, { Connection { 11, true },Connection { 20, false}, NullConnection } },
     TrackPart { 111, 125, { Connection { 10, false },Connection { 22, true}, NullConnection }, { Connection { 12, true}, NullConnection } },
     TrackPart { 126, 130, { Connection { 11, false },Connection { 15, false}, NullConnection }, { Connection { 13, true },Connection { 20, true}, NullConnection } },
     TrackPart { 131, 139, { Connection { 12, false },Connection { 20, true}, NullConnection }, { Connection { 14, true },Connection { 29, false}, NullConnection } },
@@ -166,10 +501,10 @@ inline constexpr auto MikuTracks = std::to_array<TrackPart>({
     TrackPart { 244, 246, { Connection { 1, false}, NullConnection }, { Connection { 27, true}, NullConnection } },
     TrackPart { 173, 177, { Connection { 27, true}, NullConnection }, { Connection { 22, false },Connection { 19, true}, NullConnection } },
     TrackPart { 178, 182, { Connection { 18, false}, NullConnection }, { Connection { 21, true}, NullConnection } },
-    TrackPart { 152, 162, { Connection { 13, true },Connection { 21, true}, NullConnection }, { Connection { 22, true },Connection { 10, false}, NullConnection } },
+    TrackPart { 152, 162, { Connection { 13, true },Connection { 21, true},Connection { 12, false}, NullConnection }, { Connection { 22, true },Connection { 10, false}, NullConnection } },
     TrackPart { 183, 188, { Connection { 20, true },Connection { 19, false}, NullConnection }, { Connection { 27, false}, NullConnection } },
-    TrackPart { 163, 172, { Connection { 11, true },Connection { 20, false}, NullConnection }, { Connection { 8, false },Connection { 18, false}, NullConnection } },
-    TrackPart { 213, 214, { Connection { 24, false },Connection { 6, true}, NullConnection }, { Connection { 30, false },Connection { 25, true}, NullConnection } },
+    TrackPart { 163, 172, { Connection { 11, true },Connection { 20, false}, NullConnection }, { Connection { 8, false },Connection { 9, true },Connection { 18, false}, NullConnection } },
+    TrackPart { 213, 214, { Connection { 30, false },Connection { 25, true}, NullConnection }, { Connection { 24, false },Connection { 6, true}, NullConnection } },
     TrackPart { 195, 203, { Connection { 25, false },Connection { 28, false}, NullConnection }, { Connection { 6, true },Connection { 23, false}, NullConnection } },
     TrackPart { 189, 194, { Connection { 30, false },Connection { 23, true}, NullConnection }, { Connection { 28, false },Connection { 24, true}, NullConnection } },
     TrackPart { 204, 207, { Connection { 27, false}, NullConnection }, { Connection { 30, true}, NullConnection } },
@@ -179,3 +514,14 @@ inline constexpr auto MikuTracks = std::to_array<TrackPart>({
     TrackPart { 208, 212, { Connection { 26, false },Connection { 29, true}, NullConnection }, { Connection { 23, true },Connection { 25, true}, NullConnection } },
 });
 
+
+// Index of the track part that each pixel belongs to, so track walks don't need to search MikuTracks
+inline constexpr auto MikuPixelTracks = [] {
+    std::array<int8_t, PIXEL_COUNT> pixelTracks = {};
+    for(size_t track = 0; track < MikuTracks.size(); track++)
+    {
+        for(auto pixel = MikuTracks[track].start; pixel <= MikuTracks[track].end; pixel++)
+            pixelTracks[pixel] = track;
+    }
+    return pixelTracks;
+}();
@@ -3,18 +3,8 @@
 #include "MikuLight.h"
 #include <algorithm>
 
-#include "animations/SolidMikuAnimation.h"
-#include "animations/SolidColourAnimation.h"
-#include "animations/PatternSequenceAnimation.h"
-#include "animations/WelcomeAnimation.h"
-#include "animations/RandomDropsAnimation.h"
-#include "animations/MikuPartCycleAnimation.h"
-#include "animations/PixelMapperAnimation.h"
-#include "animations/PulsingMikuAnimation.h"
-#include "animations/MikuSweepAnimation.h"
-#include "animations/PingAnimation.h"
-#include "animations/TrainAnimation.h"
-#include "animations/MarqueeAnimation.h"
+#include "AnimationRegistry.h"
+#include "AnimationPool.h"
 
 #include "ColourUtils.h"
 #include "mqttClient.h"
@@ -26,30 +16,9 @@ MikuLight::MikuLight(
     : _deviceConfig(std::move(deviceConfig)),
     _animationRunner(std::move(animationRunner)),
     _mqttClient(std::move(mqttClient)),
-    _animationNames(),
     _publishTimer([this] () { return PublishMqttState(); }, 0),
-    _saveTimer([this] () { return SaveState(); }, 0),
-    // Register built-in animations
-    _animationFactories( {
-        {"solid", "Solid Miku", []() { return std::make_unique<SolidMikuAnimation>(128); }},
-        {"pulsing", "Pulsing Miku", []() { return std::make_unique<PulsingMikuAnimation>(); }},
-        {"slowcycle", "Miku Part Cycle Slow", []() { return std::make_unique<MikuPartCycleAnimation>(1); }},
-        {"fastcycle", "Miku Part Cycle Fast", []() { return std::make_unique<MikuPartCycleAnimation>(8); }},
-        {"sweep", "Miku Sweep", []() { return std::make_unique<MikuSweepAnimation>(); }},
-        {"welcome", "Welcome Sweep", []() { return std::make_unique<WelcomeAnimation>(PIXEL_COUNT); }},
-        {"mapper", "LED Mapper", []() { return std::make_unique<PixelMapperAnimation>(PIXEL_COUNT, 4); }},
-        {"ping", "Wifi Ping", []() { return std::make_unique<PingAnimation>(); }},
-        {"drops", "Random Drops", []() { return std::make_unique<RandomDropsAnimation>(); }},
-        {"trains", "Trains", []() { return std::make_unique<TrainAnimation>(); }},
-        {"marquee", "Marquee", []() { return std::make_unique<MarqueeAnimation>(); }},
-    })
+    _saveTimer([this] () { return SaveState(); }, 0)
 {
-    // Build the name list once during construction
-    _animationNames.reserve(_animationFactories.size());
-    for (auto const& [name, description, factory] : _animationFactories) {
-        _animationNames.emplace_back(name, description);
-    }
-
 }
 
 void MikuLight::LoadConfig()
@@ -82,6 +51,11 @@ void MikuLight::LoadConfig()
                 ActivatePattern(_lightConfig.patternId);
                 break;
             }
+            case LightState::Effect:
+            {
+                ActivateEffect(_lightConfig.effectId);
+                break;
+            }
         }
 
         _publishTimer.ResetTimer(0);
@@ -95,7 +69,7 @@ void MikuLight::SetRgb(int r, int g, int b)
     r = std::clamp(r, 0, 255);
     g = std::clamp(g, 0, 255);
     b = std::clamp(b, 0, 255);
-    _animationRunner->SetAnimation(std::make_shared<SolidColourAnimation>(neopixel(r, g, b).gammaCorrected()));
+    _animationRunner->SetAnimation(MakeAnimation<SolidColourAnimation>(neopixel(r, g, b).gammaCorrected()));
 
     auto [h, s, br] = ::RGBtoHSB(r, g, b);
 
@@ -119,14 +93,14 @@ void MikuLight::SetRgb(int r, int g, int b)
 
 bool MikuLight::ActivatePattern(int patternId)
 {
-    auto pattern = _deviceConfig->GetPatternConfig(patternId);
-    if(!pattern)
+    // Resolving the chain checks the pattern exists, and is cached for the animation
+    if(!_deviceConfig->GetPatternChain(patternId))
     {
         DBG_PUT("No such pattern to activate");
         return false; // No such pattern
     }
 
-    _animationRunner->SetAnimation(std::make_shared<PatternSequenceAnimation>(patternId, _deviceConfig));
+    _animationRunner->SetAnimation(MakeAnimation<PatternSequenceAnimation>(patternId, _deviceConfig));
     _lightConfig.state = LightState::Pattern;
     _lightConfig.patternId = patternId;
     _lightConfig.animationId = 0;
@@ -136,10 +110,28 @@ bool MikuLight::ActivatePattern(int patternId)
     return true;
 }
 
+bool MikuLight::ActivateEffect(int effectId)
+{
+    auto effect = effectId >= 0 ? _deviceConfig->GetEffectConfig(effectId) : nullptr;
+    if(!effect)
+    {
+        DBG_PUT("No such effect to activate");
+        return false;
+    }
+
+    _animationRunner->SetAnimation(MakeAnimation<EffectAnimation>(effect));
+    _lightConfig.state = LightState::Effect;
+    _lightConfig.effectId = effectId;
+    _lightConfig.animationId = 0;
+
+    TriggerStateChanged();
+    return true;
+}
+
 void MikuLight::SetMikuBrightness(int brightness)
 {
     brightness = std::clamp(brightness, 0, 255);
-    _animationRunner->SetAnimation(std::make_shared<SolidMikuAnimation>(brightness));
+    _animationRunner->SetAnimation(MakeAnimation<SolidMikuAnimation>(brightness));
 
     if(brightness > 0)
     {
@@ -159,7 +151,8 @@ void MikuLight::SetMikuBrightness(int brightness)
 
 bool MikuLight::StartAnimation(int animationId)
 {
-    if(animationId < 0 || animationId >= _animationFactories.size())
+    auto animations = GetAnimations();
+    if(animationId < 0 || animationId >= animations.size())
     {
         DBG_PRINT("Unknown animation ID: %d", animationId);
         return false;
@@ -169,8 +162,7 @@ bool MikuLight::StartAnimation(int animationId)
         // Ignore requests to re-set the same current animation (usually "Solid" from HA)
         return true;
     
-    auto &[_sn, _dn, factory] = _animationFactories[animationId];
-    _animationRunner->SetAnimation(std::move(factory()));
+    _animationRunner->SetAnimation(animations[animationId].factory());
     _lightConfig.state = LightState::Animation;
     _lightConfig.animationId = animationId;
 
@@ -178,8 +170,30 @@ bool MikuLight::StartAnimation(int animationId)
     return true;
 }
 
-const std::vector<std::tuple<std::string,std::string>> &MikuLight::GetAvailableAnimations() const {
-    return _animationNames;
+bool MikuLight::StartZoneAnimation(int zone, int animationId)
+{
+    auto animations = GetAnimations();
+    if(animationId < 0 || animationId >= animations.size())
+    {
+        DBG_PRINT("Unknown animation ID: %d", animationId);
+        return false;
+    }
+
+    auto factory = animations[animationId].factory;
+    constexpr int groupCount = std::size(AggregatedMikuParts);
+    constexpr int partCount = std::size(mikuParts);
+    if(zone >= 0 && zone < groupCount)
+        return _animationRunner->SetZoneAnimation(AggregatedMikuParts[zone], factory());
+    if(zone >= groupCount && zone < groupCount + partCount)
+        return _animationRunner->SetZoneAnimation(mikuParts[zone - groupCount], factory());
+
+    DBG_PRINT("Unknown zone: %d", zone);
+    return false;
+}
+
+IAnimation *MikuLight::GetAnimation() const
+{
+    return _animationRunner->GetAnimation();
 }
 
 void MikuLight::SetBrightness(int brightness)
@@ -234,23 +248,6 @@ bool MikuLight::SwitchOff()
     return true;
 }
 
-int MikuLight::GetAnimationByName(const std::string &name) const
-{
-    auto it = std::find_if(_animationFactories.begin(), _animationFactories.end(),
-        [&name](const auto& tuple) {
-            auto& [shortName, longName, _] = tuple;
-            return shortName == name || longName == name;
-        });
-    if(it == _animationFactories.end())
-    {
-        DBG_PRINT("Unknown effect name: %s", name.c_str());
-        return -1;
-    }
-
-    auto animationId = std::distance(_animationFactories.begin(), it);
-    return animationId;
-}
-
 uint32_t MikuLight::PublishMqttState()
 {
     if(!_mqttClient->IsEnabled() )
@@ -284,12 +281,13 @@ uint32_t MikuLight::PublishMqttState()
         }
         case LightState::Animation:
         {
-            auto anim = std::get<0>(_animationNames[_lightConfig.animationId]);
+            auto anim = std::string_view(GetAnimations()[_lightConfig.animationId].name);
             _mqttClient->Publish(string_format("miku/%s/sw/state", macAddress).c_str(), (const uint8_t *)"ON", 2, true);
-            _mqttClient->Publish(string_format("miku/%s/fx/state", macAddress).c_str(), (const uint8_t *)anim.c_str(), anim.length(), true);
+            _mqttClient->Publish(string_format("miku/%s/fx/state", macAddress).c_str(), (const uint8_t *)anim.data(), anim.length(), true);
             break;
         }
         case LightState::Pattern:
+        case LightState::Effect:
         {
             // No MQTT for this...
             _mqttClient->Publish(string_format("miku/%s/sw/state", macAddress).c_str(), (const uint8_t *)"ON", 2, true);
@@ -305,4 +303,10 @@ uint32_t MikuLight::SaveState()
 {
     _deviceConfig->SaveLightConfig(&_lightConfig);
     return 0;
+}
+
+void MikuLight::SaveStateNow()
+{
+    _saveTimer.ResetTimer(0);
+    SaveState();
 }
\ No newline at end of file
@@ -16,8 +16,6 @@ public:
         std::shared_ptr<MqttClient> mqttClient
     );
 
-    const std::vector<std::tuple<std::string,std::string>> &GetAvailableAnimations() const;
-
     void LoadConfig();
     void SetMikuBrightness(int brightness);
     void SetRgb(int r, int g, int b);
@@ -25,11 +23,20 @@ public:
     void SetHueAndSaturation(float hue, float saturation);
     void SetBrightness(int brightness); // Special brightness shared between HSV and steady miku colours
     bool StartAnimation(int animationId);
+    /// @brief Runs an animation on one zone of Miku, over the top of the current light
+    /// @param zone Index into AggregatedMikuParts, followed by the individual mikuParts
+    bool StartZoneAnimation(int zone, int animationId);
+    /// @brief The running animation, for tuning its parameters
+    IAnimation *GetAnimation() const;
     bool ActivatePattern(int patternId);
+    /// @brief Runs a user defined effect program
+    bool ActivateEffect(int effectId);
     bool SwitchOn();
     bool SwitchOff();
 
-    int GetAnimationByName(const std::string &name) const;
+    /// @brief Saves the light state straight away, instead of waiting for the save timer. Call before rebooting.
+    void SaveStateNow();
+
 private:
 
     uint32_t PublishMqttState();
@@ -47,10 +54,6 @@ private:
     ScheduledTimer _publishTimer;
     ScheduledTimer _saveTimer; // Only save state after 60 seconds, to avoid flash wear
 
-    using AnimationFactory = std::function<std::unique_ptr<IAnimation>()>;
-    std::vector<std::tuple<std::string, std::string, AnimationFactory>> _animationFactories;
-    std::vector<std::tuple<std::string, std::string>> _animationNames;
-
-    LightConfig _lightConfig = { LightState::Miku, 0.0f, 0.0f, 127, 0, 0 };
+    LightConfig _lightConfig = { LightState::Miku, 0.0f, 0.0f, 127, 0, 0, 0 };
 
 };
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "MikuPaths.h"
+
+static constexpr TrackEndDistanceTable BuildTrackEndDistances()
+{
+    // Breadth first search over the pixels from each track end
+    TrackEndDistanceTable distances = {};
+    std::array<uint8_t, PIXEL_COUNT> pixelDistance = {};
+    std::array<int16_t, PIXEL_COUNT> queue = {};
+    for(size_t fromEnd = 0; fromEnd < distances.size(); fromEnd++)
+    {
+        auto &fromTrack = MikuTracks[fromEnd / 2];
+        for(auto &distance : pixelDistance)
+            distance = UnreachableDistance;
+
+        queue[0] = (fromEnd & 1) ? fromTrack.end : fromTrack.start;
+        pixelDistance[queue[0]] = 0;
+        int head = 0;
+        int tail = 1;
+        while(head < tail)
+        {
+            auto pixel = queue[head++];
+            auto &adjacent = MikuPixelNeighbours[pixel];
+            for(auto n = 0; n < adjacent.count; n++)
+            {
+                auto next = adjacent.pixels[n];
+                if(pixelDistance[next] == UnreachableDistance && pixelDistance[pixel] + 1 < UnreachableDistance)
+                {
+                    pixelDistance[next] = pixelDistance[pixel] + 1;
+                    queue[tail++] = next;
+                }
+            }
+        }
+
+        for(size_t toEnd = 0; toEnd < distances.size(); toEnd++)
+        {
+            auto &toTrack = MikuTracks[toEnd / 2];
+            distances[fromEnd][toEnd] = pixelDistance[(toEnd & 1) ? toTrack.end : toTrack.start];
+        }
+    }
+    return distances;
+}
+
+constexpr TrackEndDistanceTable MikuTrackEndDistances = BuildTrackEndDistances();
+
+void FloodFillDistances(int from, uint8_t (&distances)[PIXEL_COUNT])
+{
+    for(auto pixel = 0; pixel < PIXEL_COUNT; pixel++)
+        distances[pixel] = PixelDistance(from, pixel);
+}
+
+void ShortestPathIterator::Next()
+{
+    if(AtEnd())
+        return;
+
+    auto remaining = Remaining();
+    auto &adjacent = MikuPixelNeighbours[_pixel];
+    for(auto n = 0; n < adjacent.count; n++)
+    {
+        if(PixelDistance(adjacent.pixels[n], _target) < remaining)
+        {
+            _pixel = adjacent.pixels[n];
+            return;
+        }
+    }
+}
+
+void RandomWalkIterator::Next(FastRandom &random)
+{
+    auto &adjacent = MikuPixelNeighbours[_pixel];
+
+    // Pick from the neighbours we didn't just come from
+    int16_t choices[MaxPixelNeighbours];
+    int count = 0;
+    for(auto n = 0; n < adjacent.count; n++)
+    {
+        if(adjacent.pixels[n] != _previous)
+            choices[count++] = adjacent.pixels[n];
+    }
+
+    _previous = _pixel;
+    if(count == 0)
+        _pixel = adjacent.pixels[0]; // Dead end, turn around
+    else
+        _pixel = choices[count == 1 ? 0 : random.Below(count)];
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "Miku.h"
+#include "FastRandom.h"
+
+// Path finding over the physical LED runs described by MikuTracks. The adjacency and distance
+// tables are built at compile time, so they live in flash and cost nothing to set up.
+
+// An end pixel links to the rest of its own track, plus every connected track
+constexpr int MaxPixelNeighbours = MaxTrackConnections + 1;
+
+// Distance reported between pixels that can't reach each other
+constexpr uint8_t UnreachableDistance = 255;
+
+struct PixelNeighbours
+{
+    std::array<int16_t, MaxPixelNeighbours> pixels;
+    int count;
+};
+
+/// @brief Checks the MikuTracks data is usable for path finding
+/// @return true if every pixel is on exactly one track, and every connection is listed at both ends
+constexpr bool AreMikuTracksValid()
+{
+    std::array<int, PIXEL_COUNT> pixelUse = {};
+    for(size_t track = 0; track < MikuTracks.size(); track++)
+    {
+        auto &part = MikuTracks[track];
+        if(part.start >= part.end || part.start < 0 || part.end >= PIXEL_COUNT)
+            return false;
+        for(auto pixel = part.start; pixel <= part.end; pixel++)
+            pixelUse[pixel]++;
+
+        for(auto atEnd : { false, true })
+        {
+            auto connections = part.GetConnections(atEnd);
+            if(connections[MaxTrackConnections].track >= 0)
+                return false; // Unterminated list
+
+            for(auto connection = connections; connection->track >= 0; connection++)
+            {
+                if(connection->track == (int)track || connection->track >= (int)MikuTracks.size())
+                    return false;
+
+                // The far end must list this end of this track
+                auto found = false;
+                for(auto back = MikuTracks[connection->track].GetConnections(!connection->start); back->track >= 0; back++)
+                    found |= back->track == (int)track && back->start == !atEnd;
+                if(!found)
+                    return false;
+            }
+        }
+    }
+
+    for(auto use : pixelUse)
+    {
+        if(use != 1)
+            return false;
+    }
+    return true;
+}
+
+static_assert(AreMikuTracksValid(), "MikuTracks must cover every pixel once, and every connection must be listed at both ends");
+
+// Pixels that are physically next to each pixel
+inline constexpr auto MikuPixelNeighbours = [] {
+    std::array<PixelNeighbours, PIXEL_COUNT> neighbours = {};
+    for(auto &track : MikuTracks)
+    {
+        for(auto pixel = track.start; pixel <= track.end; pixel++)
+        {
+            auto &adjacent = neighbours[pixel];
+            if(pixel > track.start)
+                adjacent.pixels[adjacent.count++] = pixel - 1;
+            if(pixel < track.end)
+                adjacent.pixels[adjacent.count++] = pixel + 1;
+        }
+
+        for(auto atEnd : { false, true })
+        {
+            auto &adjacent = neighbours[atEnd ? track.end : track.start];
+            for(auto connection = track.GetConnections(atEnd); connection->track >= 0; connection++)
+                adjacent.pixels[adjacent.count++] = connection->start ? MikuTracks[connection->track].start : MikuTracks[connection->track].end;
+        }
+    }
+    return neighbours;
+}();
+
+// Steps between the ends of every pair of tracks, indexed [track * 2 + atEnd][track * 2 + atEnd]
+using TrackEndDistanceTable = std::array<std::array<uint8_t, MikuTracks.size() * 2>, MikuTracks.size() * 2>;
+
+extern const TrackEndDistanceTable MikuTrackEndDistances;
+
+/// @brief Number of steps along the LED runs between two pixels, in constant time
+/// @return The distance, or UnreachableDistance if there is no route
+inline int PixelDistance(int from, int to)
+{
+    auto fromTrack = MikuPixelTracks[from];
+    auto toTrack = MikuPixelTracks[to];
+    auto &fromPart = MikuTracks[fromTrack];
+    auto &toPart = MikuTracks[toTrack];
+
+    int best = fromTrack == toTrack ? (from > to ? from - to : to - from) : UnreachableDistance;
+
+    // Otherwise, leave by one end of this track and arrive at one end of the other
+    for(auto fromEnd = 0; fromEnd < 2; fromEnd++)
+    {
+        auto &ends = MikuTrackEndDistances[fromTrack * 2 + fromEnd];
+        auto leave = fromEnd ? fromPart.end - from : from - fromPart.start;
+        for(auto toEnd = 0; toEnd < 2; toEnd++)
+        {
+            auto between = ends[toTrack * 2 + toEnd];
+            if(between == UnreachableDistance)
+                continue;
+            auto arrive = toEnd ? toPart.end - to : to - toPart.start;
+            if(leave + between + arrive < best)
+                best = leave + between + arrive;
+        }
+    }
+    return best < UnreachableDistance ? best : UnreachableDistance;
+}
+
+/// @brief Flood fill from a pixel, so wavefront effects can look up each pixel's distance from the origin
+/// @param from Origin pixel
+/// @param distances [out] Steps from the origin to each pixel
+void FloodFillDistances(int from, uint8_t (&distances)[PIXEL_COUNT]);
+
+/// @brief Steps along the shortest route between two pixels
+class ShortestPathIterator
+{
+public:
+    ShortestPathIterator(int from, int to) : _pixel(from), _target(to) {}
+
+    int Pixel() const { return _pixel; }
+    int Remaining() const { return PixelDistance(_pixel, _target); }
+    bool AtEnd() const { return _pixel == _target || Remaining() == UnreachableDistance; }
+
+    /// @brief Moves one pixel closer to the target
+    void Next();
+
+private:
+    int _pixel;
+    int _target;
+};
+
+/// @brief Wanders randomly along the LED runs, never doubling back unless it reaches a dead end
+class RandomWalkIterator
+{
+public:
+    RandomWalkIterator(int start = 0, int previous = -1) : _pixel(start), _previous(previous) {}
+
+    int Pixel() const { return _pixel; }
+
+    /// @brief Moves to a random neighbouring pixel
+    void Next(FastRandom &random);
+
+private:
+    int _pixel;
+    int _previous;
+};
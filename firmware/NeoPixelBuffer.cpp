@@ -3,17 +3,22 @@
 #include <string.h>
 #include "NeoPixelBuffer.h"
 #include "neopixel.pio.h"
+#include "hardware/sync.h"
+#include "hardware/structs/timer.h"
 
 static NeoPixelBuffer *_dma0Buffer = nullptr;
 static NeoPixelBuffer *_dma1Buffer = nullptr;
 
+// Time the data line must be held low after a frame, before the pixels show it, in microseconds
+static constexpr uint32_t LatchTime = 400;
+
 void __isr NeoPixelBuffer::Dma0CompleteHandler()
 {
     if (dma_hw->ints0 & 1)
     {
         // clear IRQ
         dma_hw->ints0 = 1;
-        add_alarm_in_us(400, NeoPixelBuffer::LatchDelayCompleteEntry, _dma0Buffer, true);
+        add_alarm_in_us(LatchTime, NeoPixelBuffer::LatchDelayCompleteEntry, _dma0Buffer, true);
     }
 }
 
@@ -23,7 +28,7 @@ void __isr NeoPixelBuffer::Dma1CompleteHandler()
     {
         // clear IRQ
         dma_hw->ints0 = 2;
-        add_alarm_in_us(400, NeoPixelBuffer::LatchDelayCompleteEntry, _dma1Buffer, true);
+        add_alarm_in_us(LatchTime, NeoPixelBuffer::LatchDelayCompleteEntry, _dma1Buffer, true);
     }
 }
 
@@ -102,3 +107,74 @@ int64_t NeoPixelBuffer::LatchDelayComplete()
     return 0;
 }
 
+
+void NeoPixelBuffer::BeginPolledOutput()
+{
+    sem_acquire_blocking(&_swapReady);
+    if(_irq == DMA_IRQ_0)
+        dma_channel_set_irq0_enabled(_dmaChannel, false);
+    else
+        dma_channel_set_irq1_enabled(_dmaChannel, false);
+}
+
+// Starts the DMA for a frame once the last one has gone out and latched. The registers are used directly, as SDK
+// helpers aren't certain to be inlined, so this is safe to use from RAM.
+static __force_inline void StartPolledFrame(dma_channel_hw_t *channel, PIO pio, uint32_t txEmpty, const neopixel *frame)
+{
+    while(channel->ctrl_trig & DMA_CH0_CTRL_TRIG_BUSY_BITS)
+        ;
+    while(!(pio->fstat & txEmpty))
+        ;
+    auto latchStart = timer_hw->timerawl;
+    while(timer_hw->timerawl - latchStart < LatchTime)
+        ;
+
+    channel->al3_read_addr_trig = (uintptr_t)frame;
+}
+
+int __not_in_flash_func(NeoPixelBuffer::PlayFromRam)(const neopixel *const *frames, const uint32_t *showTimes, int count, const volatile bool &busy)
+{
+    // Nothing here may touch flash, and interrupts are off so a handler in flash can't run either
+    auto channel = &dma_hw->ch[_dmaChannel];
+    auto txEmpty = 1u << (PIO_FSTAT_TXEMPTY_LSB + _stateMachine);
+    auto shown = 0;
+    while(shown < count)
+    {
+        while((int32_t)(timer_hw->timerawl - showTimes[shown]) < 0)
+        {
+            if(!busy)
+                return shown;
+        }
+        StartPolledFrame(channel, _pio, txEmpty, frames[shown++]);
+    }
+
+    while(busy)
+        ;
+    return shown;
+}
+
+void NeoPixelBuffer::ShowPolled(const neopixel *frame)
+{
+    StartPolledFrame(&dma_hw->ch[_dmaChannel], _pio, 1u << (PIO_FSTAT_TXEMPTY_LSB + _stateMachine), frame);
+}
+
+void NeoPixelBuffer::EndPolledOutput(const neopixel *lastShown)
+{
+    while(dma_channel_is_busy(_dmaChannel))
+        tight_loop_contents();
+    while(!pio_sm_is_tx_fifo_empty(_pio, _stateMachine))
+        tight_loop_contents();
+    sleep_us(LatchTime);
+
+    // The next Swap shows the back buffer again, and draws over the front buffer
+    if(lastShown != _backBuffer.data())
+        ::memcpy(_backBuffer.data(), lastShown, sizeof(neopixel) * _pixelCount);
+
+    // Don't let the polled frames set off the interrupt
+    dma_hw->intr = _dmaMask;
+    if(_irq == DMA_IRQ_0)
+        dma_channel_set_irq0_enabled(_dmaChannel, true);
+    else
+        dma_channel_set_irq1_enabled(_dmaChannel, true);
+    sem_release(&_swapReady);
+}
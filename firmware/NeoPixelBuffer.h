@@ -69,6 +69,31 @@ class NeoPixelBuffer
             return NeoPixelFrame(_backBuffer.data(), _frontBuffer.data(), _pixelCount);
         }
 
+        uint32_t GetPixelCount() const
+        {
+            return _pixelCount;
+        }
+
+        /// @brief Takes over showing frames from the DMA interrupt, once the frame being shown is out
+        /// @remarks The interrupt runs on the other core, which can't take it while writing flash
+        void BeginPolledOutput();
+
+        /// @brief Shows frames at the given times, running only from RAM so it carries on while flash is written
+        /// @remarks Call with interrupts off. It returns as soon as busy is cleared and the next frame isn't due yet,
+        /// so the rest can be shown with ShowPolled once interrupts are back on.
+        /// @param frames Frames to show, in order
+        /// @param showTimes When to show each frame, as time_us_32
+        /// @param busy Set while the flash is in use. The last frame is held until this is cleared.
+        /// @return How many of the frames were shown
+        int PlayFromRam(const neopixel *const *frames, const uint32_t *showTimes, int count, const volatile bool &busy);
+
+        /// @brief Shows a frame between BeginPolledOutput and EndPolledOutput, as soon as the last one has gone out
+        void ShowPolled(const neopixel *frame);
+
+        /// @brief Hands showing frames back to the DMA interrupt
+        /// @param lastShown The last frame played, which the next Swap picks up from
+        void EndPolledOutput(const neopixel *lastShown);
+
 
     private:
 
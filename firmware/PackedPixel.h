@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+// Helpers that work on packed neopixel colours, handling all four colour channels with each 32 bit operation
+
+/// @brief Average of each colour channel of two packed pixels, rounded down
+inline uint32_t PackedAverage(uint32_t a, uint32_t b)
+{
+    // Sum of the common bits, plus half the differing bits, without carries crossing between channels
+    return (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1);
+}
+
+/// @brief Adds each colour channel of two packed pixels, clamping at 255
+inline uint32_t PackedAddSaturate(uint32_t a, uint32_t b)
+{
+    // Add the low 7 bits of each channel, then work out the real top bit and carry out of each channel
+    auto low = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+    auto carry = ((a & b) | ((a | b) & low)) & 0x80808080;
+    auto sum = low ^ ((a ^ b) & 0x80808080);
+    return sum | ((carry >> 7) * 0xFF);
+}
+
+/// @brief Linear interpolation of each colour channel between two packed pixels
+/// @param weight 0 gives a, 256 gives b
+inline uint32_t PackedLerp(uint32_t a, uint32_t b, uint32_t weight)
+{
+    // Alternate channels are spread into 16 bit lanes, so there's room for the multiply
+    auto aEven = a & 0x00FF00FF;
+    auto aOdd = (a >> 8) & 0x00FF00FF;
+    auto bEven = b & 0x00FF00FF;
+    auto bOdd = (b >> 8) & 0x00FF00FF;
+    auto even = ((aEven * (256 - weight) + bEven * weight) >> 8) & 0x00FF00FF;
+    auto odd = (aOdd * (256 - weight) + bOdd * weight) & 0xFF00FF00;
+    return even | odd;
+}
+
+/// @brief Scales each colour channel of a packed pixel
+/// @param scale 0 to 256
+inline uint32_t PackedScale(uint32_t a, uint32_t scale)
+{
+    auto even = (((a & 0x00FF00FF) * scale) >> 8) & 0x00FF00FF;
+    auto odd = (((a >> 8) & 0x00FF00FF) * scale) & 0xFF00FF00;
+    return even | odd;
+}
+
+/// @brief Largest of each colour channel of two packed pixels
+inline uint32_t PackedMax(uint32_t a, uint32_t b)
+{
+    // Compare the low 7 bits of each channel without borrows crossing channels, then settle it with the top bits
+    auto lowGreaterOrEqual = ((a | 0x80808080) - (b & 0x7F7F7F7F)) & 0x80808080;
+    auto aTop = a & 0x80808080;
+    auto bTop = b & 0x80808080;
+    auto greaterOrEqual = (aTop & ~bTop) | (~(aTop ^ bTop) & lowGreaterOrEqual);
+    auto mask = (greaterOrEqual >> 7) * 0xFF;
+    return (a & mask) | (b & ~mask);
+}
+
+/// @brief Product of each colour channel of two packed pixels, with 255 as 1.0
+inline uint32_t PackedMultiply(uint32_t a, uint32_t b)
+{
+    uint32_t result = 0;
+    for(auto shift = 0; shift < 32; shift += 8)
+        result |= ((((a >> shift) & 0xFF) * ((b >> shift) & 0xFF) + 255) >> 8) << shift;
+    return result;
+}
@@ -0,0 +1,38 @@
+#include "Particles.h"
+
+// Stamp each LED into the cells around it, keeping whichever LED is closest to the centre of each cell
+constexpr std::array<std::array<int16_t, ParticleGridSize>, ParticleGridSize> MikuNearestPixelGrid = [] {
+    std::array<std::array<int16_t, ParticleGridSize>, ParticleGridSize> grid = {};
+    std::array<std::array<int, ParticleGridSize>, ParticleGridSize> bestDistance = {};
+    for(auto &row : grid)
+        row.fill(-1);
+
+    constexpr int cellSize = 1 << ParticleGridShift;
+    constexpr int cellReach = (ParticleReach + cellSize - 1) / cellSize;
+    for(auto pixel = 0; pixel < PIXEL_COUNT; pixel++)
+    {
+        auto px = PixelPositions[pixel].x;
+        auto py = PixelPositions[pixel].y;
+        for(auto cy = (py >> ParticleGridShift) - cellReach; cy <= (py >> ParticleGridShift) + cellReach; cy++)
+        {
+            for(auto cx = (px >> ParticleGridShift) - cellReach; cx <= (px >> ParticleGridShift) + cellReach; cx++)
+            {
+                if(cx < 0 || cy < 0 || cx >= ParticleGridSize || cy >= ParticleGridSize)
+                    continue;
+
+                // Compare distances to the centre of the cell, in half units
+                auto dx = (cx * cellSize * 2 + cellSize) - px * 2;
+                auto dy = (cy * cellSize * 2 + cellSize) - py * 2;
+                auto distance = dx * dx + dy * dy;
+                if(distance > ParticleReach * ParticleReach * 4)
+                    continue;
+                if(grid[cy][cx] < 0 || distance < bestDistance[cy][cx])
+                {
+                    grid[cy][cx] = pixel;
+                    bestDistance[cy][cx] = distance;
+                }
+            }
+        }
+    }
+    return grid;
+}();
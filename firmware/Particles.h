@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include "Miku.h"
+#include "PixelFilters.h"
+
+// Particles move around the same 127x127 space as PixelPositions, and light up the nearest LED.
+
+// Positions and velocities are 8.8 fixed point
+constexpr int ParticleOne = 256;
+
+// The nearest pixel grid has 2x2 unit cells
+constexpr int ParticleGridShift = 1;
+constexpr int ParticleGridSize = 128 >> ParticleGridShift;
+
+// Particles further than this from any LED aren't drawn
+constexpr int ParticleReach = 4;
+
+// Particles fade out over the last few frames of their life
+constexpr int ParticleFadeFrames = 16;
+
+// Index of the nearest LED to each grid cell, indexed [y][x]. -1 where there is no LED within reach
+extern const std::array<std::array<int16_t, ParticleGridSize>, ParticleGridSize> MikuNearestPixelGrid;
+
+struct Particle
+{
+    int16_t x;          // 8.8 position
+    int16_t y;
+    int16_t dx;         // 8.8 velocity per frame
+    int16_t dy;
+    neopixel colour;    // Added to the LED as-is, so should already be gamma corrected
+    uint16_t life;      // Frames left to live
+};
+
+/// @brief Fixed size pool of particles that never allocates
+template<size_t Capacity>
+class ParticlePool
+{
+public:
+    size_t Count() const { return _count; }
+
+    void Clear() { _count = 0; }
+
+    /// @brief Adds a new particle to the pool
+    /// @return false if the pool is full
+    bool Spawn(int x, int y, int dx, int dy, neopixel colour, uint16_t life)
+    {
+        if(_count == Capacity)
+            return false;
+        _particles[_count++] = Particle { (int16_t)x, (int16_t)y, (int16_t)dx, (int16_t)dy, colour, life };
+        return true;
+    }
+
+    /// @brief Moves and ages all of the particles, removing any that die or leave the grid
+    /// @param gravity 8.8 change to the y velocity each frame
+    void Update(int gravity)
+    {
+        for(size_t i = 0; i < _count; )
+        {
+            auto &p = _particles[i];
+            int x = p.x + p.dx;
+            int y = p.y + p.dy;
+            if(p.life == 0 || x < 0 || y < 0 || x >= 128 * ParticleOne || y >= 128 * ParticleOne)
+            {
+                // Order doesn't matter, so fill the gap with the last particle
+                p = _particles[--_count];
+                continue;
+            }
+
+            p.x = x;
+            p.y = y;
+            p.dy += gravity;
+            p.life--;
+            i++;
+        }
+    }
+
+    /// @brief Adds every particle to the colour of its nearest LED
+    void Splat(neopixel *buffer) const
+    {
+        for(size_t i = 0; i < _count; i++)
+        {
+            auto &p = _particles[i];
+            auto pixel = MikuNearestPixelGrid[p.y >> (8 + ParticleGridShift)][p.x >> (8 + ParticleGridShift)];
+            if(pixel < 0)
+                continue;
+
+            auto colour = p.life < ParticleFadeFrames ? p.colour.fade(p.life * (256 / ParticleFadeFrames)) : p.colour;
+            buffer[pixel].colour = PackedAddSaturate(buffer[pixel].colour, colour.colour);
+        }
+    }
+
+private:
+    std::array<Particle, Capacity> _particles;
+    size_t _count = 0;
+};
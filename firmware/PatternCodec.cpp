@@ -0,0 +1,190 @@
+
+#include "mikuPixel.h"
+#include "PatternCodec.h"
+#include "deviceConfig.h"
+#include <algorithm>
+#include <cstddef>
+#include <string.h>
+
+// The first byte is 0xFF, which can't start the name of a PatternConfig stored by older firmware
+static constexpr uint16_t PackedPatternMagic = 0x50FF;
+
+static constexpr int MaxRun = 256;
+static constexpr size_t MaxPaletteSize = 255;
+
+struct PackedPatternHeader
+{
+    uint16_t magic;
+    uint8_t paletteSize;    // 0 when the pixels follow as plain RGB
+    uint8_t nameLength;     // The name follows the header, without a terminator
+    int32_t nextFrameId;
+    int32_t frameTime;
+    int32_t transitionTime;
+};
+
+static uint32_t Rgb(neopixel pixel)
+{
+    return neopixel(pixel.red, pixel.green, pixel.blue).colour;
+}
+
+static void AppendRgb(std::vector<uint8_t> &data, neopixel pixel)
+{
+    data.insert(data.end(), { (uint8_t)pixel.red, (uint8_t)pixel.green, (uint8_t)pixel.blue });
+}
+
+std::vector<uint8_t> PackPattern(const PatternConfig &pattern)
+{
+    std::vector<uint32_t> palette;
+    auto paletted = true;
+    for(auto &pixel : pattern.pixels)
+    {
+        auto colour = Rgb(pixel);
+        if(std::find(palette.begin(), palette.end(), colour) == palette.end())
+        {
+            if(palette.size() == MaxPaletteSize)
+            {
+                paletted = false;
+                break;
+            }
+            palette.push_back(colour);
+        }
+    }
+
+    std::vector<uint8_t> runs;
+    if(paletted)
+    {
+        for(auto pixel = 0; pixel < PIXEL_COUNT; )
+        {
+            auto colour = Rgb(pattern.pixels[pixel]);
+            auto run = 1;
+            while(run < MaxRun && pixel + run < PIXEL_COUNT && Rgb(pattern.pixels[pixel + run]) == colour)
+                run++;
+            pixel += run;
+
+            runs.push_back(run - 1);
+            runs.push_back(std::find(palette.begin(), palette.end(), colour) - palette.begin());
+        }
+
+        // Lots of short runs take more room than plain RGB
+        if(palette.size() * 3 + runs.size() >= PIXEL_COUNT * 3)
+            paletted = false;
+    }
+
+    PackedPatternHeader header = {};
+    header.magic = PackedPatternMagic;
+    header.paletteSize = paletted ? palette.size() : 0;
+    header.nameLength = strnlen(pattern.patternName, sizeof(pattern.patternName) - 1);
+    header.nextFrameId = pattern.nextFrameId;
+    header.frameTime = pattern.frameTime;
+    header.transitionTime = pattern.transitionTime;
+
+    std::vector<uint8_t> data((const uint8_t *)&header, (const uint8_t *)(&header + 1));
+    data.insert(data.end(), pattern.patternName, pattern.patternName + header.nameLength);
+    if(paletted)
+    {
+        for(auto colour : palette)
+            AppendRgb(data, neopixel(colour));
+        data.insert(data.end(), runs.begin(), runs.end());
+    }
+    else
+    {
+        for(auto &pixel : pattern.pixels)
+            AppendRgb(data, pixel);
+    }
+    return data;
+}
+
+bool IsPackedPattern(const uint8_t *data, size_t size)
+{
+    uint16_t magic;
+    if(size < sizeof(PackedPatternHeader))
+        return false;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == PackedPatternMagic;
+}
+
+bool UnpackPatternPixels(const uint8_t *data, size_t size, neopixel *pixels)
+{
+    if(!IsPackedPattern(data, size))
+        return false;
+
+    // Stored blocks may not be aligned for the header, and could be damaged, so check every length
+    PackedPatternHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t position = sizeof(header) + header.nameLength;
+    auto palette = data + position;
+
+    if(!header.paletteSize)
+    {
+        if(position + PIXEL_COUNT * 3 > size)
+            return false;
+        for(auto pixel = 0; pixel < PIXEL_COUNT; pixel++, palette += 3)
+            pixels[pixel] = neopixel(palette[0], palette[1], palette[2]);
+        return true;
+    }
+
+    position += header.paletteSize * 3;
+    for(auto pixel = 0; pixel < PIXEL_COUNT; )
+    {
+        if(position + 2 > size)
+            return false;
+        auto run = data[position] + 1;
+        auto index = data[position + 1];
+        position += 2;
+        if(index >= header.paletteSize || run > PIXEL_COUNT - pixel)
+            return false;
+
+        auto colour = palette + index * 3;
+        std::fill(pixels + pixel, pixels + pixel + run, neopixel(colour[0], colour[1], colour[2]));
+        pixel += run;
+    }
+    return true;
+}
+
+bool UnpackPatternSummary(const uint8_t *data, size_t size, PatternSummary &summary)
+{
+    static_assert(sizeof(summary.patternName) == sizeof(PatternConfig::patternName));
+    if(!IsPackedPattern(data, size))
+    {
+        if(size < sizeof(PatternConfig))
+            return false;
+        memcpy(summary.patternName, data + offsetof(PatternConfig, patternName), sizeof(summary.patternName));
+        memcpy(&summary.nextFrameId, data + offsetof(PatternConfig, nextFrameId), sizeof(summary.nextFrameId));
+        summary.patternName[sizeof(summary.patternName) - 1] = 0;
+        return true;
+    }
+
+    PackedPatternHeader header;
+    memcpy(&header, data, sizeof(header));
+    if(header.nameLength >= sizeof(summary.patternName) || sizeof(header) + header.nameLength > size)
+        return false;
+    memcpy(summary.patternName, data + sizeof(header), header.nameLength);
+    summary.patternName[header.nameLength] = 0;
+    summary.nextFrameId = header.nextFrameId;
+    return true;
+}
+
+bool UnpackPattern(const uint8_t *data, size_t size, PatternConfig &pattern)
+{
+    if(!IsPackedPattern(data, size))
+    {
+        // A whole PatternConfig, from before patterns were packed
+        if(size < sizeof(PatternConfig))
+            return false;
+        memcpy(&pattern, data, sizeof(PatternConfig));
+        pattern.patternName[sizeof(pattern.patternName) - 1] = 0;
+        return true;
+    }
+
+    PackedPatternHeader header;
+    memcpy(&header, data, sizeof(header));
+    if(header.nameLength >= sizeof(pattern.patternName) || !UnpackPatternPixels(data, size, pattern.pixels))
+        return false;
+
+    memcpy(pattern.patternName, data + sizeof(header), header.nameLength);
+    pattern.patternName[header.nameLength] = 0;
+    pattern.nextFrameId = header.nextFrameId;
+    pattern.frameTime = header.frameTime;
+    pattern.transitionTime = header.transitionTime;
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "NeoPixel.h"
+
+struct PatternConfig;
+struct PatternSummary;
+
+// Patterns are stored packed, as most are a few flat colours over each part of Miku. The pixels are runs of colours
+// from a palette, in strip order so the runs follow the parts. Patterns with too many colours for that are stored
+// as plain RGB. The white channel is never used, so it isn't stored.
+
+/// @brief Packs a pattern for storing in flash
+std::vector<uint8_t> PackPattern(const PatternConfig &pattern);
+
+/// @brief Checks whether a stored block is a packed pattern, rather than a whole PatternConfig from older firmware
+bool IsPackedPattern(const uint8_t *data, size_t size);
+
+/// @brief Unpacks a stored pattern, either packed or a PatternConfig from older firmware
+/// @return false if the block isn't a valid pattern
+bool UnpackPattern(const uint8_t *data, size_t size, PatternConfig &pattern);
+
+/// @brief Unpacks just the name and next frame of a stored pattern
+/// @return false if the block isn't a valid pattern
+bool UnpackPatternSummary(const uint8_t *data, size_t size, PatternSummary &summary);
+
+/// @brief Unpacks just the pixels of a packed pattern. They're written in order, so can go straight into a frame.
+/// @param pixels PIXEL_COUNT pixels to fill
+/// @return false if the block isn't a valid packed pattern
+bool UnpackPatternPixels(const uint8_t *data, size_t size, neopixel *pixels);
@@ -4,13 +4,14 @@
 #include "PatternEditor.h"
 #include "EditableImage.h"
 #include "AnimationRunner.h"
+#include "AnimationPool.h"
 
 PatternEditor::PatternEditor(uint16_t patternId, const neopixel *pixels, uint32_t pixelCount, AnimationRunner *animationRunner, std::shared_ptr<WebServer> webServer)
 :   _patternId(patternId),
-    _editableImage(std::make_shared<EditableImage>(pixels, pixelCount)),
+    _pixels(std::make_shared<std::vector<neopixel>>(pixels, pixels + pixelCount)),
     _setLedSubscription(MakeCgiSubscription<bool>(webServer, "/api/patterns/setLed.json", [this](const CgiParams &params) { return OnSetLed(params);}))
 {
-    animationRunner->SetAnimation(_editableImage);
+    animationRunner->SetAnimation(MakeAnimation<EditableImage>(_pixels));
 }
 
 bool PatternEditor::OnSetLed(const CgiParams &params)
@@ -28,5 +29,8 @@ bool PatternEditor::OnSetLed(const CgiParams &params)
     int index = std::stoul(pixelIndex->second);
     auto rgb = neopixel(std::stoul(rparam->second), std::stoul(gparam->second), std::stoul(bparam->second));
 
-    return _editableImage->SetPixel(index, rgb);
+    if(index >= _pixels->size())
+        return false;
+    (*_pixels)[index] = rgb;
+    return true;
 }
\ No newline at end of file
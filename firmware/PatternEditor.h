@@ -3,10 +3,8 @@
 #include <memory>
 #include "deviceConfig.h"
 #include "webServer.h"
-#include "EditableImage.h"
 
 class AnimationRunner;
-class EditableImage;
 
 class PatternEditor
 {
@@ -35,14 +33,14 @@ class PatternEditor
 
         const std::vector<neopixel> & GetPixels() const
         {
-            return _editableImage->GetPixels();
+            return *_pixels;
         }
 
     private:
         bool OnSetLed(const CgiParams &params);
 
         CgiSubscription _setLedSubscription;
-        std::shared_ptr<EditableImage> _editableImage;
+        std::shared_ptr<std::vector<neopixel>> _pixels;  // Shared with the EditableImage animation
         uint16_t _patternId;
 
 };
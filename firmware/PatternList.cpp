@@ -10,8 +10,7 @@
 PatternList::PatternList(std::shared_ptr<WebServer> webServer, std::shared_ptr<DeviceConfig> deviceConfig, std::shared_ptr<AnimationRunner> animationRunner)
 :   _webServer(std::move(webServer)),
     _deviceConfig(std::move(deviceConfig)),
-    _animationRunner(std::move(animationRunner)),
-    _getPattern(nullptr)
+    _animationRunner(std::move(animationRunner))
 {
 
     _cgiHandlers.push_back(MakeCgiSubscription<bool>(_webServer, "/api/patterns/beginEdit.json", [this](const CgiParams &params) { return BeginEdit(params); }));
@@ -39,8 +38,8 @@ int16_t PatternList::HandlePatternsResponse(char *pcInsert, int iInsertLen, uint
     }
 
     auto patternId = patternIds[tagPart];
-    auto pattern = _deviceConfig->GetPatternConfig(patternId);
-    if(!pattern)
+    PatternSummary pattern;
+    if(!_deviceConfig->GetPatternSummary(patternId, pattern))
     {
         DBG_PRINT("No pattern %d found\n", patternId);
         return 0; // No such pattern
@@ -50,12 +49,12 @@ int16_t PatternList::HandlePatternsResponse(char *pcInsert, int iInsertLen, uint
     outputter.Append("{ \"id\": ");
     outputter.Append((int)patternId);
     outputter.Append(", \"name\": \"");
-    outputter.AppendEscaped(pattern->patternName);
+    outputter.AppendEscaped(pattern.patternName);
     outputter.Append("\", \"nextFrame\": ");
-    if(pattern->nextFrameId < 0)
+    if(pattern.nextFrameId < 0)
         outputter.Append("null");
     else
-        outputter.Append((int)pattern->nextFrameId);
+        outputter.Append((int)pattern.nextFrameId);
 
     if(tagPart + 1 < count)
     {
@@ -118,7 +117,7 @@ int16_t PatternList::HandlePatternResponse(char *pcInsert, int iInsertLen, uint1
     else
     {
         outputter.Append("} ]}");
-        _getPattern = nullptr;
+        _getPattern.reset();
     }
 
     return outputter.BytesWritten();
@@ -126,18 +125,19 @@ int16_t PatternList::HandlePatternResponse(char *pcInsert, int iInsertLen, uint1
 
 uint16_t PatternList::CreateNewPatternId()
 {
-    uint16_t newId = 0;
+    // The IDs are in order, so a new one goes after the last, unless they've run out and there's a gap to reuse.
+    // Saving the pattern is what adds it to the list.
     uint32_t count;
     const uint16_t *patternIds = _deviceConfig->GetPatternIds(&count);
-    if(count > 0)
-        newId = *std::max_element(patternIds, patternIds + count) + 1;
-
-    uint16_t ids[128];
-    std::copy(patternIds, patternIds + count, ids);
-    ids[count] = newId;
-    _deviceConfig->SavePatternIds(ids, count + 1);
+    if(count == 0)
+        return 0;
+    if(patternIds[count - 1] < UINT16_MAX)
+        return patternIds[count - 1] + 1;
 
-    return newId;
+    uint32_t newId = 0;
+    while(newId < count && patternIds[newId] == newId)
+        newId++;
+    return (uint16_t)newId;
 }
 
 uint16_t PatternList::AddPattern(const CgiParams &params)
@@ -254,8 +254,14 @@ bool PatternList::SaveGetParams(const CgiParams &params)
         return false;
     auto getId = (uint16_t)std::stoul(patternId->second);
 
-    _getPattern = _deviceConfig->GetPatternConfig(getId);
-    return _getPattern != nullptr; // Return true if pattern exists
+    auto pattern = _deviceConfig->GetPatternConfig(getId);
+    if(!pattern)
+    {
+        _getPattern.reset();
+        return false;
+    }
+    _getPattern = std::make_unique<PatternConfig>(*pattern);
+    return true;
 }
 
 
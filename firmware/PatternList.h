@@ -7,7 +7,7 @@
 #include "PatternEditor.h"
 
 class AnimationRunner;
-class PatternConfig;
+struct PatternConfig;
 
 class PatternList
 {
@@ -36,7 +36,7 @@ private:
     std::list<SsiSubscription> _ssiHandlers;
     std::list<CgiSubscription> _cgiHandlers;
 
-    const PatternConfig *_getPattern; // Current pattern being read by the API
+    std::unique_ptr<PatternConfig> _getPattern; // Copy of the pattern being read by the API, as it's read over many calls
 
     std::shared_ptr<WebServer> _webServer;
     std::shared_ptr<DeviceConfig> _deviceConfig;
@@ -0,0 +1,254 @@
+
+#include "mikuPixel.h"
+#include "PatternSequence.h"
+#include "deviceConfig.h"
+#include <algorithm>
+#include <string.h>
+
+// Index into the palette that means the colour follows as red, green and blue
+static constexpr uint8_t LiteralColour = 255;
+
+// Ops in a frame:
+//   0x00 - 0x7F: skip (n + 1) pixels, which are unchanged from the previous frame
+//   0x80 - 0xFF: set ((n & 0x7F) + 1) pixels to the palette colour in the next byte
+static constexpr uint8_t RunFlag = 0x80;
+static constexpr int MaxRun = 128;
+
+static constexpr uint8_t KeyframeFlag = 0x01;
+
+struct SequenceHeader
+{
+    uint32_t length;      // Length of the whole container
+    uint32_t loopOffset;
+    uint16_t frameCount;
+    uint16_t paletteSize;
+};
+
+struct SequenceFrameHeader
+{
+    uint16_t frameTime;
+    uint16_t transitionTime;
+    uint16_t opsLength;
+    uint8_t flags;
+    uint8_t reserved;
+};
+
+static void Append(std::vector<uint8_t> &data, const void *bytes, size_t size)
+{
+    data.insert(data.end(), (const uint8_t *)bytes, (const uint8_t *)bytes + size);
+}
+
+static std::vector<uint8_t> Pack(DeviceConfig &deviceConfig, const PatternChain &chain)
+{
+    auto loopFrame = chain.loopFrame;
+
+    // Build the palette from every colour used, most patterns only have a few.
+    // Patterns are unpacked one at a time, as there's no room to hold them all.
+    std::vector<uint32_t> palette;
+    std::vector<neopixel> pixels(PIXEL_COUNT);
+    std::vector<neopixel> previous(PIXEL_COUNT);
+    for(auto patternId : chain.patternIds)
+    {
+        if(!deviceConfig.GetPatternPixels(patternId, pixels.data()))
+            return {};
+        for(auto &pixel : pixels)
+        {
+            if(palette.size() < LiteralColour && std::find(palette.begin(), palette.end(), pixel.colour) == palette.end())
+                palette.push_back(pixel.colour);
+        }
+    }
+
+    std::vector<uint8_t> data(sizeof(SequenceHeader));
+    for(auto colour : palette)
+    {
+        neopixel pixel(colour);
+        uint8_t rgb[] = { (uint8_t)pixel.red, (uint8_t)pixel.green, (uint8_t)pixel.blue };
+        Append(data, rgb, sizeof(rgb));
+    }
+
+    SequenceHeader header = {};
+    std::vector<uint8_t> ops;
+    for(size_t index = 0; index < chain.patternIds.size(); index++)
+    {
+        auto frame = deviceConfig.GetPatternConfig(chain.patternIds[index]);
+        if(!frame)
+            return {};
+        pixels.assign(frame->pixels, frame->pixels + PIXEL_COUNT);
+
+        auto keyframe = index == 0 || (int)index == loopFrame;
+        if((int)index == loopFrame)
+            header.loopOffset = data.size();
+
+        ops.clear();
+        for(auto pixel = 0; pixel < PIXEL_COUNT; )
+        {
+            auto colour = pixels[pixel].colour;
+            auto run = 1;
+            if(!keyframe && previous[pixel].colour == colour)
+            {
+                while(run < MaxRun && pixel + run < PIXEL_COUNT && previous[pixel + run].colour == pixels[pixel + run].colour)
+                    run++;
+                pixel += run;
+
+                // Pixels left over at the end are unchanged anyway
+                if(pixel < PIXEL_COUNT)
+                    ops.push_back(run - 1);
+                continue;
+            }
+
+            while(run < MaxRun && pixel + run < PIXEL_COUNT && pixels[pixel + run].colour == colour)
+                run++;
+            pixel += run;
+
+            ops.push_back(RunFlag | (run - 1));
+            auto entry = std::find(palette.begin(), palette.end(), colour);
+            if(entry != palette.end())
+                ops.push_back(entry - palette.begin());
+            else
+            {
+                neopixel literal(colour);
+                ops.insert(ops.end(), { LiteralColour, (uint8_t)literal.red, (uint8_t)literal.green, (uint8_t)literal.blue });
+            }
+        }
+
+        SequenceFrameHeader frameHeader = {};
+        frameHeader.frameTime = std::clamp<int32_t>(frame->frameTime, 0, UINT16_MAX);
+        frameHeader.transitionTime = std::clamp<int32_t>(frame->transitionTime, 0, UINT16_MAX);
+        frameHeader.opsLength = ops.size();
+        frameHeader.flags = keyframe ? KeyframeFlag : 0;
+        Append(data, &frameHeader, sizeof(frameHeader));
+        Append(data, ops.data(), ops.size());
+        previous.swap(pixels);
+    }
+
+    header.length = data.size();
+    header.frameCount = chain.patternIds.size();
+    header.paletteSize = palette.size();
+    memcpy(data.data(), &header, sizeof(header));
+    return data;
+}
+
+PatternSequence::PatternSequence()
+{
+    Close();
+}
+
+void PatternSequence::Close()
+{
+    _length = 0;
+    _position = 0;
+    _framesStart = 0;
+    _loopOffset = 0;
+    _frameCount = 0;
+    _paletteSize = 0;
+    _data.clear();
+}
+
+bool PatternSequence::Open(DeviceConfig &deviceConfig, uint16_t startPatternId)
+{
+    Close();
+
+    auto chain = deviceConfig.GetPatternChain(startPatternId);
+    if(!chain)
+    {
+        DBG_PRINT("No pattern %d to start a sequence\n", startPatternId);
+        return false;
+    }
+
+    _data = Pack(deviceConfig, *chain);
+    if(_data.empty())
+        return false;
+    DBG_PRINT("Packed %d frames into %d bytes\n", (int)chain->patternIds.size(), (int)_data.size());
+
+    _length = _data.size();
+    SequenceHeader header;
+    if(!Read(&header, sizeof(header)) || header.paletteSize > std::size(_palette))
+    {
+        Close();
+        return false;
+    }
+
+    _paletteSize = header.paletteSize;
+    for(uint32_t i = 0; i < _paletteSize; i++)
+    {
+        uint8_t rgb[3];
+        Read(rgb, sizeof(rgb));
+        _palette[i] = neopixel(rgb[0], rgb[1], rgb[2]);
+    }
+
+    _frameCount = header.frameCount;
+    _framesStart = _position;
+    _loopOffset = header.loopOffset;
+    return true;
+}
+
+bool PatternSequence::Read(void *data, uint32_t size)
+{
+    if(_position + size > _length)
+        return false;
+
+    memcpy(data, _data.data() + _position, size);
+    _position += size;
+    return true;
+}
+
+int PatternSequence::ReadByte()
+{
+    if(_position >= _length)
+        return -1;
+    return _data[_position++];
+}
+
+bool PatternSequence::DecodeFrame(const neopixel *previous, neopixel *pixels, SequenceFrameTiming &timing)
+{
+    if(!IsOpen())
+        return false;
+
+    if(_position >= _length)
+    {
+        if(!_loopOffset)
+            return false;
+        _position = _loopOffset;
+    }
+
+    SequenceFrameHeader header;
+    if(!Read(&header, sizeof(header)))
+        return false;
+    timing.frameTime = header.frameTime;
+    timing.transitionTime = header.transitionTime;
+
+    if(header.flags & KeyframeFlag)
+        std::fill(pixels, pixels + PIXEL_COUNT, neopixel());
+    else
+        std::copy(previous, previous + PIXEL_COUNT, pixels);
+
+    auto end = std::min(_position + header.opsLength, _length);
+    auto pixel = 0;
+    while(_position < end && pixel < PIXEL_COUNT)
+    {
+        auto op = ReadByte();
+        auto run = (op & ~RunFlag) + 1;
+        if(!(op & RunFlag))
+        {
+            pixel += run;
+            continue;
+        }
+
+        neopixel colour;
+        auto index = ReadByte();
+        if(index == LiteralColour)
+        {
+            uint8_t rgb[3] = {};
+            Read(rgb, sizeof(rgb));
+            colour = neopixel(rgb[0], rgb[1], rgb[2]);
+        }
+        else if(index >= 0 && index < (int)_paletteSize)
+            colour = _palette[index];
+
+        run = std::min(run, PIXEL_COUNT - pixel);
+        std::fill(pixels + pixel, pixels + pixel + run, colour);
+        pixel += run;
+    }
+    _position = end;
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "NeoPixel.h"
+
+class DeviceConfig;
+
+// A chain of patterns linked by nextFrameId, packed into one container: a shared palette, then each frame as
+// palette indexed runs. The first frame, and the frame a looping sequence returns to, are keyframes. Every other
+// frame only encodes the pixels that changed since the frame before it.
+//
+// The container is packed into RAM when the sequence starts, and each frame is decoded from there without looking
+// anything up. It isn't kept in flash, as it would need a copy for every start pattern and the storage compaction could
+// move it while it plays.
+
+/// @brief Timing of one frame of a sequence
+struct SequenceFrameTiming
+{
+    uint16_t frameTime;       // How long the frame is shown before the transition starts, in milliseconds
+    uint16_t transitionTime;  // Duration of the transition to the next frame. 0 to cut straight to it.
+};
+
+class PatternSequence
+{
+public:
+    PatternSequence();
+
+    PatternSequence(const PatternSequence &) = delete;
+    PatternSequence &operator=(const PatternSequence &) = delete;
+
+    /// @brief Opens the sequence starting at a pattern, packing it into RAM
+    /// @remarks Reads the patterns, so only call this on core0
+    bool Open(DeviceConfig &deviceConfig, uint16_t startPatternId);
+
+    bool IsOpen() const { return _length > 0; }
+    uint32_t FrameCount() const { return _frameCount; }
+
+    /// @brief Decodes the next frame of the sequence
+    /// @param previous The frame decoded before this one, which delta frames are drawn over
+    /// @param pixels [out] The decoded frame
+    /// @return false at the end of a sequence that doesn't loop
+    bool DecodeFrame(const neopixel *previous, neopixel *pixels, SequenceFrameTiming &timing);
+
+private:
+    void Close();
+
+    bool Read(void *data, uint32_t size);
+    int ReadByte();
+
+    uint32_t _length;
+    uint32_t _position;
+
+    uint32_t _framesStart;    // Offset of the first frame
+    uint32_t _loopOffset;     // Offset of the frame the sequence loops back to, or 0 if it stops
+    uint32_t _frameCount;
+
+    uint32_t _paletteSize;
+    neopixel _palette[255];
+
+    std::vector<uint8_t> _data;
+};
@@ -0,0 +1,53 @@
+// Copyright (c) 2025 Mark Godwin.
+// SPDX-License-Identifier: MIT
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "PicoFlash.h"
+
+static_assert(IFlash::PageSize == FLASH_PAGE_SIZE);
+static_assert(IFlash::SectorSize == FLASH_SECTOR_SIZE);
+static_assert(IFlash::Ok == PICO_OK);
+
+struct FlashParams
+{
+    uint32_t offset;
+    const uint8_t *data;
+    size_t size;
+};
+
+void PicoFlash::SetExecutor(FlashExecutor &&executor)
+{
+    _executor = std::move(executor);
+}
+
+const uint8_t *PicoFlash::Map(uint32_t offset) const
+{
+    return (const uint8_t *)(XIP_BASE + offset);
+}
+
+int PicoFlash::Program(uint32_t offset, const uint8_t *data, size_t size)
+{
+    FlashParams params = { offset, data, size };
+    return Execute([](void *p) {
+        auto params = (FlashParams *)p;
+        flash_range_program(params->offset, params->data, params->size);
+    }, &params, PageProgramTime * (size / PageSize));
+}
+
+int PicoFlash::Erase(uint32_t offset, size_t size)
+{
+    FlashParams params = { offset, nullptr, size };
+    return Execute([](void *p) {
+        auto params = (FlashParams *)p;
+        flash_range_erase(params->offset, params->size);
+    }, &params, SectorEraseTime * (size / SectorSize));
+}
+
+int PicoFlash::Execute(void (*func)(void *), void *param, uint32_t busyTime)
+{
+    if(_executor)
+        return _executor(func, param, busyTime);
+    return flash_safe_execute(func, param, 1000);
+}
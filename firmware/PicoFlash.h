@@ -0,0 +1,27 @@
+// Copyright (c) 2025 Mark Godwin.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "IFlash.h"
+#include <functional>
+
+/// @brief The Pico's own flash, read through the XIP window
+class PicoFlash : public IFlash
+{
+public:
+    /// @brief Runs a function that writes flash, keeping anything else off the flash while it does
+    /// @remarks func and param are as for flash_safe_execute, which is used by default. busyTime is roughly how long
+    /// the flash will be busy, in microseconds.
+    using FlashExecutor = std::function<int(void (*func)(void *), void *param, uint32_t busyTime)>;
+    void SetExecutor(FlashExecutor &&executor);
+
+    const uint8_t *Map(uint32_t offset) const override;
+    int Program(uint32_t offset, const uint8_t *data, size_t size) override;
+    int Erase(uint32_t offset, size_t size) override;
+
+private:
+    int Execute(void (*func)(void *), void *param, uint32_t busyTime);
+
+    FlashExecutor _executor;
+};
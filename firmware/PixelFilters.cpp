@@ -0,0 +1,29 @@
+#include "PixelFilters.h"
+#include "MikuPaths.h"
+
+constexpr std::array<std::array<uint16_t, 4>, PIXEL_COUNT> MikuFilterNeighbours = [] {
+    std::array<std::array<uint16_t, 4>, PIXEL_COUNT> table = {};
+    for(auto pixel = 0; pixel < PIXEL_COUNT; pixel++)
+    {
+        auto &adjacent = MikuPixelNeighbours[pixel];
+        auto &n = adjacent.pixels;
+        switch(adjacent.count)
+        {
+            case 1:
+                table[pixel] = { (uint16_t)n[0], (uint16_t)n[0], (uint16_t)n[0], (uint16_t)n[0] };
+                break;
+            case 2:
+                table[pixel] = { (uint16_t)n[0], (uint16_t)n[1], (uint16_t)n[0], (uint16_t)n[1] };
+                break;
+            case 3:
+                table[pixel] = { (uint16_t)n[0], (uint16_t)n[1], (uint16_t)n[2], (uint16_t)pixel };
+                break;
+            default:
+                table[pixel] = { (uint16_t)n[0], (uint16_t)n[1], (uint16_t)n[2], (uint16_t)n[3] };
+                break;
+        }
+    }
+    return table;
+}();
+
+static_assert(MaxPixelNeighbours <= 4, "MikuFilterNeighbours only has room for four neighbours");
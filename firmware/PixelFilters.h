@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Miku.h"
+#include "PackedPixel.h"
+
+// Neighbourhood filters that follow the LED runs in MikuTracks, rather than the order of the pixel indexes.
+
+// Four pixels to average for the neighbourhood of each pixel, so the filter needs no branches.
+// Dead ends and plain runs repeat their neighbours. A three way junction includes the pixel itself.
+extern const std::array<std::array<uint16_t, 4>, PIXEL_COUNT> MikuFilterNeighbours;
+
+/// @brief Runs a kernel over every pixel and its physical neighbourhood
+/// @param input Pixels to read. Must not be the same buffer as output
+/// @param output Pixels to write
+/// @param kernel Called with each packed pixel and the packed average of its neighbours. Returns the new packed pixel.
+template<typename Kernel>
+void FilterAlongTracks(const neopixel *input, neopixel *output, Kernel &&kernel)
+{
+    for(auto pixel = 0; pixel < PIXEL_COUNT; pixel++)
+    {
+        auto &neighbours = MikuFilterNeighbours[pixel];
+        auto average = PackedAverage(
+            PackedAverage(input[neighbours[0]].colour, input[neighbours[1]].colour),
+            PackedAverage(input[neighbours[2]].colour, input[neighbours[3]].colour));
+        output[pixel].colour = kernel(input[pixel].colour, average);
+    }
+}
+
+/// @brief Spreads light along the LED runs: each pixel becomes half itself, half its neighbours
+inline void DiffuseAlongTracks(const neopixel *input, neopixel *output)
+{
+    FilterAlongTracks(input, output, [](uint32_t pixel, uint32_t neighbours) { return PackedAverage(pixel, neighbours); });
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2025 Mark Godwin.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "IFlash.h"
+#include <algorithm>
+#include <vector>
+
+/// @brief Flash simulated in RAM, to run BlockStorage on a PC and check its wear leveling and recovery
+/// @remarks Follows the rules of the real flash: programming can only clear bits, and only erasing sets them again.
+/// A power cut can be set to interrupt a later write part way through, after which every write fails until PowerOn,
+/// as a reboot would.
+class RamFlash : public IFlash
+{
+public:
+    RamFlash(size_t size)
+    :   _data(size, 0xFF),
+        _eraseCounts(size / SectorSize),
+        _programs(0),
+        _setBytes(0),
+        _cutCountdown(0),
+        _cutBytes(0),
+        _powerOff(false)
+    {
+    }
+
+    const uint8_t *Map(uint32_t offset) const override
+    {
+        return _data.data() + offset;
+    }
+
+    int Program(uint32_t offset, const uint8_t *data, size_t size) override
+    {
+        if(_powerOff || offset % PageSize || size % PageSize || offset + size > _data.size())
+            return Failed;
+
+        auto cut = CutNow();
+        auto end = cut ? std::min(size, _cutBytes) : size;
+        for(size_t i = 0; i < end; i++)
+        {
+            // 0xFF bytes leave the flash as it is, which is how part of a page is programmed. Any other byte that needs
+            // bits setting is a bug in the caller. They stay cleared, as they would on the flash.
+            if(data[i] != 0xFF && (data[i] & ~_data[offset + i]))
+                _setBytes++;
+            _data[offset + i] &= data[i];
+        }
+        _programs += size / PageSize;
+        return cut ? Failed : Ok;
+    }
+
+    int Erase(uint32_t offset, size_t size) override
+    {
+        if(_powerOff || offset % SectorSize || size % SectorSize || offset + size > _data.size())
+            return Failed;
+
+        auto cut = CutNow();
+        auto end = cut ? std::min(size, _cutBytes) : size;
+        std::fill(_data.begin() + offset, _data.begin() + offset + end, 0xFF);
+        for(auto sector = offset / SectorSize; sector < (offset + size) / SectorSize; sector++)
+            _eraseCounts[sector]++;
+        return cut ? Failed : Ok;
+    }
+
+    /// @brief Cuts the power during a later write
+    /// @param writes Number of Program or Erase calls to let through first
+    /// @param bytes How much of the interrupted write gets done
+    void CutPowerAfter(uint32_t writes, size_t bytes)
+    {
+        _cutCountdown = writes + 1;
+        _cutBytes = bytes;
+    }
+
+    /// @brief Restores the power after a cut, so writes work again
+    void PowerOn()
+    {
+        _cutCountdown = 0;
+        _powerOff = false;
+    }
+
+    bool IsPowerOff() const { return _powerOff; }
+
+    uint32_t EraseCount(uint32_t sector) const { return _eraseCounts[sector]; }
+    const std::vector<uint32_t> &EraseCounts() const { return _eraseCounts; }
+
+    /// @brief Pages programmed, including any cut short
+    uint64_t ProgramCount() const { return _programs; }
+
+    /// @brief Bytes a program needed bits setting in without an erase. Should always be 0.
+    uint64_t SetByteCount() const { return _setBytes; }
+
+private:
+    bool CutNow()
+    {
+        if(!_cutCountdown || --_cutCountdown)
+            return false;
+        _powerOff = true;
+        return true;
+    }
+
+    std::vector<uint8_t> _data;
+    std::vector<uint32_t> _eraseCounts;
+    uint64_t _programs;
+    uint64_t _setBytes;
+    uint32_t _cutCountdown;     // Writes until the power is cut, counting the one that's cut. 0 for no cut.
+    size_t _cutBytes;
+    bool _powerOff;
+};
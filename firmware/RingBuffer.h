@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+/// @brief Fixed capacity FIFO that never allocates
+/// @remarks Pushing into a full buffer overwrites the oldest item. Index 0 is the oldest item.
+template<typename T, size_t Capacity>
+class RingBuffer
+{
+public:
+    static constexpr size_t MaxSize() { return Capacity; }
+
+    size_t Size() const { return _count; }
+    bool Empty() const { return _count == 0; }
+    bool Full() const { return _count == Capacity; }
+
+    void Clear()
+    {
+        _first = 0;
+        _count = 0;
+    }
+
+    void Push(const T &item)
+    {
+        if(_count == Capacity)
+            PopFront();
+        _items[(_first + _count) % Capacity] = item;
+        _count++;
+    }
+
+    void PopFront()
+    {
+        _first = (_first + 1) % Capacity;
+        _count--;
+    }
+
+    T &Front() { return _items[_first]; }
+    const T &Front() const { return _items[_first]; }
+    T &Back() { return _items[(_first + _count - 1) % Capacity]; }
+    const T &Back() const { return _items[(_first + _count - 1) % Capacity]; }
+
+    T &operator[](size_t index) { return _items[(_first + index) % Capacity]; }
+    const T &operator[](size_t index) const { return _items[(_first + index) % Capacity]; }
+
+    /// @brief Reverses the order of the items in place
+    void Reverse()
+    {
+        for(size_t a = 0, b = _count - 1; a < b && b < _count; a++, b--)
+            std::swap((*this)[a], (*this)[b]);
+    }
+
+private:
+    std::array<T, Capacity> _items = {};
+    size_t _first = 0;
+    size_t _count = 0;
+};
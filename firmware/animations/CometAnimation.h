@@ -0,0 +1,45 @@
+#pragma once
+
+#include "IAnimation.h"
+#include "Miku.h"
+#include "MikuPaths.h"
+#include "NeoPixelBuffer.h"
+
+// Comets wandering along the LED runs, leaving fading tails behind them
+class CometAnimation : public IAnimation
+{
+public:
+    CometAnimation(uint32_t seed = 0) : _random(seed)
+    {
+        for(auto i = 0; i < std::size(_comets); i++)
+            _comets[i] = RandomWalkIterator(i * PIXEL_COUNT / std::size(_comets));
+    }
+
+    virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override
+    {
+        const neopixel colours[] = {
+            HairColour.gammaCorrected(),
+            HairbandColour.gammaCorrected(),
+            TieColour.gammaCorrected(),
+            FaceColour.gammaCorrected()
+        };
+
+        // Fade out whatever was shown last frame to leave tails
+        auto input = frame.GetLastBuffer();
+        auto output = frame.GetBuffer();
+        for(auto x = 0; x < PIXEL_COUNT; x++)
+            output[x] = input[x].fade(220);
+
+        for(auto i = 0; i < std::size(_comets); i++)
+        {
+            _comets[i].Next(_random);
+            output[_comets[i].Pixel()] = colours[i % std::size(colours)];
+        }
+
+        return 1000 / 60;
+    }
+
+private:
+    FastRandom _random;
+    RandomWalkIterator _comets[6];
+};
@@ -0,0 +1,49 @@
+#include "mikuPixel.h"
+#include "EffectAnimation.h"
+#include "deviceConfig.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// MaxEffectCost is worked out for the number of pixels on the model
+static_assert(PIXEL_COUNT * (MaxEffectCost + EffectPixelCost) <= EffectFrameBudget, "Effects would take too long to draw");
+
+EffectAnimation::EffectAnimation(const EffectConfig *config)
+: _codeLength(std::min<uint16_t>(config->codeLength, MaxEffectCodeLength)),
+  _frameTime(std::max<uint16_t>(config->frameTime, 1000 / 60)),
+  _valid(false)
+{
+    memcpy(_code, config->code, _codeLength);
+
+    // Programs are checked when uploaded, but check again in case the flash holds something older or damaged
+    _valid = ValidateEffect(_code, _codeLength);
+    if(!_valid)
+        DBG_PRINT("Effect %s is not a valid program\n", config->effectName);
+}
+
+uint32_t EffectAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frameCounter)
+{
+    if(!_valid)
+    {
+        frame.Clear();
+        return 1000;
+    }
+
+    // Validation limits every program to MaxEffectCost, so a frame takes at most EffectFrameBudget
+    EffectInputs inputs;
+    inputs.time = frameCounter;
+    for(auto partIndex = 0; partIndex < (int)std::size(mikuParts); partIndex++)
+    {
+        auto &part = mikuParts[partIndex];
+        inputs.segment = partIndex;
+        for(auto idx = part.index; idx < part.index + part.length; idx++)
+        {
+            inputs.index = idx;
+            inputs.x = PixelPositions[idx].x;
+            inputs.y = PixelPositions[idx].y;
+            frame.SetPixel(idx, RunEffect(_code, _codeLength, inputs).gammaCorrected());
+        }
+    }
+
+    return _frameTime;
+}
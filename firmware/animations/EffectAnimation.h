@@ -0,0 +1,24 @@
+#pragma once
+
+#include "IAnimation.h"
+#include "Miku.h"
+#include "NeoPixelBuffer.h"
+#include "EffectVm.h"
+
+struct EffectConfig;
+
+// Runs a user defined effect program for every pixel
+class EffectAnimation : public IAnimation
+{
+public:
+    EffectAnimation(const EffectConfig *config);
+
+    virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override;
+
+private:
+    // A copy of the program, so it stays valid if the effect is rewritten in flash while running
+    uint8_t _code[MaxEffectCodeLength];
+    uint16_t _codeLength;
+    uint16_t _frameTime;
+    bool _valid;
+};
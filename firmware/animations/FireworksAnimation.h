@@ -0,0 +1,62 @@
+#pragma once
+
+#include "IAnimation.h"
+#include "Miku.h"
+#include "NeoPixelBuffer.h"
+#include "FastRandom.h"
+#include "Particles.h"
+
+// Bursts of sparks that fall across the Miku outline
+class FireworksAnimation : public IAnimation
+{
+public:
+    FireworksAnimation(uint32_t seed = 0) : _random(seed) {}
+
+    virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override
+    {
+        // Launch a new burst every second or so
+        if(_random.Below(60) == 0)
+            Burst();
+
+        _particles.Update(ParticleOne / 64); // Gravity
+
+        // Leave short trails behind the sparks
+        auto input = frame.GetLastBuffer();
+        auto output = frame.GetBuffer();
+        for(auto x = 0; x < PIXEL_COUNT; x++)
+            output[x] = input[x].fade(160);
+
+        _particles.Splat(output);
+
+        return 1000 / 60;
+    }
+
+private:
+    void Burst()
+    {
+        // 16 directions around a circle, 8.8 fixed point
+        constexpr int16_t directions[16][2] = {
+            { 256, 0 }, { 237, 98 }, { 181, 181 }, { 98, 237 }, { 0, 256 }, { -98, 237 }, { -181, 181 }, { -237, 98 },
+            { -256, 0 }, { -237, -98 }, { -181, -181 }, { -98, -237 }, { 0, -256 }, { 98, -237 }, { 181, -181 }, { 237, -98 }
+        };
+        const neopixel colours[] = { HairColour, HairbandColour, TieColour, FaceColour, neopixel(255, 200, 64) };
+
+        auto origin = PixelPositions[_random.Below(PIXEL_COUNT)];
+        auto colour = colours[_random.Below(std::size(colours))].gammaCorrected();
+        for(auto i = 0; i < 64; i++)
+        {
+            auto &direction = directions[i % std::size(directions)];
+            int speed = 64 + _random.Below(256); // Quarter to one and a quarter units per frame
+            _particles.Spawn(
+                origin.x * ParticleOne,
+                origin.y * ParticleOne,
+                direction[0] * speed / 256,
+                direction[1] * speed / 256,
+                colour,
+                30 + _random.Below(40));
+        }
+    }
+
+    FastRandom _random;
+    ParticlePool<384> _particles;
+};
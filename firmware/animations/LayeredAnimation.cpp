@@ -0,0 +1,98 @@
+#include "mikuPixel.h"
+#include "LayeredAnimation.h"
+#include "PackedPixel.h"
+#include <algorithm>
+
+LayeredAnimation::LayeredAnimation()
+: _layerCount(0),
+  _lastDelay(0),
+  _buffers(),
+  _spare(MaxLayers)
+{
+}
+
+bool LayeredAnimation::AddLayer(AnimationHandle animation, BlendMode mode, uint8_t opacity, const MikuPart *mask)
+{
+    if(_layerCount >= MaxLayers)
+        return false;
+
+    auto &layer = _layers[_layerCount++];
+    layer.animation = std::move(animation);
+    layer.mode = mode;
+    layer.weight = opacity + (opacity >> 7);
+    layer.frameCounter = 0;
+    layer.remaining = 0;
+    layer.current = _layerCount - 1;
+
+    if(mask == nullptr)
+    {
+        layer.mask.set();
+    }
+    else
+    {
+        layer.mask.reset();
+        for(; mask->index >= 0; mask++)
+        {
+            for(auto idx = mask->index; idx < mask->index + mask->length; idx++)
+                layer.mask.set(idx);
+        }
+    }
+    return true;
+}
+
+uint32_t LayeredAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frameCounter)
+{
+    // Only redraw the layers that are due. The others keep showing their last frame.
+    int32_t nextDelay = 1000;
+    for(auto i = 0; i < _layerCount; i++)
+    {
+        auto &layer = _layers[i];
+        layer.remaining -= _lastDelay;
+        if(layer.remaining <= 0)
+        {
+            // The spare was last used by some other layer, so it starts from this layer's last frame
+            auto previous = layer.current;
+            layer.current = _spare;
+            _spare = previous;
+            ::memcpy(_buffers[layer.current], _buffers[previous], sizeof(_buffers[0]));
+            layer.remaining = std::max<int32_t>(1, layer.animation->DrawFrame(
+                NeoPixelFrame(_buffers[layer.current], _buffers[previous], PIXEL_COUNT),
+                layer.frameCounter++));
+        }
+        nextDelay = std::min(nextDelay, layer.remaining);
+    }
+
+    // Blend all the layers in a single pass over the pixels
+    auto output = frame.GetBuffer();
+    for(auto idx = 0; idx < PIXEL_COUNT; idx++)
+    {
+        uint32_t colour = 0;
+        for(auto i = 0; i < _layerCount; i++)
+        {
+            auto &layer = _layers[i];
+            if(!layer.mask[idx])
+                continue;
+
+            auto source = _buffers[layer.current][idx].colour;
+            switch(layer.mode)
+            {
+                case BlendMode::Normal:
+                    colour = PackedLerp(colour, source, layer.weight);
+                    break;
+                case BlendMode::Add:
+                    colour = PackedAddSaturate(colour, PackedScale(source, layer.weight));
+                    break;
+                case BlendMode::Multiply:
+                    colour = PackedLerp(colour, PackedMultiply(colour, source), layer.weight);
+                    break;
+                case BlendMode::Max:
+                    colour = PackedLerp(colour, PackedMax(colour, source), layer.weight);
+                    break;
+            }
+        }
+        output[idx].colour = colour;
+    }
+
+    _lastDelay = nextDelay;
+    return nextDelay;
+}
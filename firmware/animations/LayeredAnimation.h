@@ -0,0 +1,54 @@
+#pragma once
+
+#include "IAnimation.h"
+#include "AnimationHandle.h"
+#include "NeoPixelBuffer.h"
+#include "Miku.h"
+#include <array>
+#include <bitset>
+
+enum class BlendMode
+{
+    Normal,
+    Add,
+    Multiply,
+    Max
+};
+
+/// @brief Draws a stack of animations at once, blending each layer over the ones below it
+class LayeredAnimation : public IAnimation
+{
+public:
+    static constexpr int MaxLayers = 4;
+
+    LayeredAnimation();
+
+    /// @brief Adds a layer on top of the existing layers
+    /// @param opacity 0 to 255
+    /// @param mask Optional NullPart terminated list of the parts the layer covers, such as MikuHairBands
+    /// @return false if all the layers are already in use
+    bool AddLayer(AnimationHandle animation, BlendMode mode = BlendMode::Normal, uint8_t opacity = 255, const MikuPart *mask = nullptr);
+
+    virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override;
+
+private:
+    struct Layer
+    {
+        AnimationHandle animation;
+        BlendMode mode;
+        uint32_t weight;            // Opacity scaled to 0-256
+        std::bitset<PIXEL_COUNT> mask;
+        uint32_t frameCounter;
+        int32_t remaining;          // ms until the layer's next frame is due
+        int current;                // Which buffer holds the layer's latest frame
+    };
+
+    std::array<Layer, MaxLayers> _layers;
+    int _layerCount;
+    uint32_t _lastDelay;
+
+    // A buffer for each layer's latest frame, and a spare that the next layer due is drawn into.
+    // The layer's old buffer then becomes the spare, so animations that read their last frame still work.
+    neopixel _buffers[MaxLayers + 1][PIXEL_COUNT];
+    int _spare;
+};
@@ -1,23 +1,40 @@
 #pragma once
 
 #include "IAnimation.h"
+#include "AnimationParameters.h"
 #include "Miku.h"
 #include "NeoPixelBuffer.h"
 
-class MikuPartCycleAnimation : public IAnimation
+inline constexpr std::array<AnimationParameter, 1> partCycleParameters = {{
+    { "speed", ParameterType::Integer, 1, 64, 1 }   // Speed of the fade
+}};
+
+class MikuPartCycleAnimation : public TunableAnimation<1>
 {
 public:
+    enum Parameter { Speed };
+
     MikuPartCycleAnimation(uint32_t speed)
+    : TunableAnimation(partCycleParameters),
+      _position(0)
     {
-        _speed = speed;
+        _parameters.Initialise(Speed, speed);
     }
 
     virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override
     {
+        _parameters.Latch();
+
         memset(frame.GetBuffer(), 0, sizeof(neopixel) * PIXEL_COUNT);
 
-        int fade = (frameCounter * _speed) % 256;
-        int partIndex = ((frameCounter * _speed) / 256) % 10;
+        // Keep a running position rather than scaling the frame counter, so speed changes don't jump
+        if(frameCounter == 0)
+            _position = 0;
+        else
+            _position += _parameters[Speed];
+
+        int fade = _position % 256;
+        int partIndex = (_position / 256) % 10;
         auto part = mikuParts[partIndex];
 
         // Fading out
@@ -55,5 +72,5 @@ public:
     }
 
 private:
-    uint32_t _speed; // Speed of the fade
+    uint32_t _position; // Progress through the cycle, 256 per part
 };
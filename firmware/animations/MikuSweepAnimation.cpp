@@ -3,6 +3,7 @@
 #include "Miku.h"
 #include "NeoPixelBuffer.h"
 #include <cmath>
+#include <algorithm>
 
 // Sweep types and their direction vectors
 static const struct {
@@ -19,13 +20,25 @@ static const struct {
     {1, -1}   // Diagonal down-right
 };
 
+static constexpr std::array<AnimationParameter, 3> sweepParameters = {{
+    { "interval", ParameterType::Integer, 2, 1200, 120 },   // Frames between sweep starts
+    { "width", ParameterType::Integer, 1, 128, 32 },        // Width of the sweep in pixels
+    { "duration", ParameterType::Integer, 1, 1200, 60 }     // How long each sweep takes
+}};
+
+MikuSweepAnimation::MikuSweepAnimation()
+: TunableAnimation(sweepParameters)
+{
+}
+
 uint32_t MikuSweepAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frameCounter)
 {
+    _parameters.Latch();
 
     // Calculate sweep parameters
-    constexpr int32_t sweepInterval = 120;  // Frames between sweep starts
-    constexpr int32_t sweepWidth = 32;     // Width of the sweep in pixels
-    constexpr int32_t sweepDuration = 60;  // How long each sweep takes
+    int32_t sweepInterval = _parameters[SweepInterval];
+    int32_t sweepWidth = _parameters[SweepWidth];
+    int32_t sweepDuration = std::min(_parameters[SweepDuration], sweepInterval);
 
     int32_t sweepPhase = frameCounter % sweepInterval;
     if (sweepPhase >= sweepDuration) {
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "IAnimation.h"
+#include "AnimationParameters.h"
 #include "NeoPixelBuffer.h"
 
-class MikuSweepAnimation : public IAnimation
+class MikuSweepAnimation : public TunableAnimation<3>
 {
 public:
-    //MikuSweepAnimation();
+    enum Parameter { SweepInterval, SweepWidth, SweepDuration };
+
+    MikuSweepAnimation();
 
     virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override;
 
@@ -1,25 +1,44 @@
+
 #include "mikuPixel.h"
 #include "PatternSequenceAnimation.h"
+#include "PackedPixel.h"
 #include <algorithm>
 
 PatternSequenceAnimation::PatternSequenceAnimation(uint16_t startPatternId, std::shared_ptr<DeviceConfig> deviceConfig)
-    : _deviceConfig(std::move(deviceConfig))
-    , _currentPatternId(startPatternId)
-    , _currentPattern(nullptr)
-    , _nextPattern(nullptr)
+    : _patterns{}
+    , _gammaPatterns{}
+    , _current(0)
+    , _currentTiming{}
+    , _nextTiming{}
+    , _hasNext(false)
     , _transitionStartTime(0)
+    , _transitionDuration(0)
     , _inTransition(false)
 {
-    // Load the initial pattern
-    _currentPattern = _deviceConfig->GetPatternConfig(_currentPatternId);
-    if (_currentPattern && _currentPattern->nextFrameId >= 0) {
-        _nextPattern = _deviceConfig->GetPatternConfig(_currentPattern->nextFrameId);
+    // Load the initial pattern. The sequence is found, and packed if needed, here on core0.
+    if (_sequence.Open(*deviceConfig, startPatternId)
+        && _sequence.DecodeFrame(_patterns[1], _patterns[0], _currentTiming)) {
+        std::transform(_patterns[0], _patterns[0] + PIXEL_COUNT, _gammaPatterns[0], [](const neopixel &pixel) { return pixel.gammaCorrected(); });
+        DecodeNextPattern();
+    }
+}
+
+void PatternSequenceAnimation::DecodeNextPattern()
+{
+    // A sequence of one pattern has nothing to move on to
+    auto next = 1 - _current;
+    _hasNext = _sequence.FrameCount() > 1
+        && _sequence.DecodeFrame(_patterns[_current], _patterns[next], _nextTiming);
+
+    // Gamma correct once per pattern, rather than on every frame it's drawn in
+    if (_hasNext) {
+        std::transform(_patterns[next], _patterns[next] + PIXEL_COUNT, _gammaPatterns[next], [](const neopixel &pixel) { return pixel.gammaCorrected(); });
     }
 }
 
 uint32_t PatternSequenceAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frameCounter)
 {
-    if (!_currentPattern) {
+    if (!_sequence.IsOpen()) {
         // No valid pattern, output black and wait a bit
         std::fill(frame.GetBuffer(), frame.GetBuffer() + PIXEL_COUNT, neopixel(0,0,0));
         return 1000; // Wait 1 second before trying again
@@ -32,49 +51,39 @@ uint32_t PatternSequenceAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frame
         elapsed = frameCounter - _transitionStartTime;
         
         if (elapsed >= _transitionDuration) {
-            // Transition complete - make next frame current
-            _currentPattern = _nextPattern;
-            _currentPatternId = _currentPattern->nextFrameId;
-            _inTransition = false;
-            
-            // Load the next pattern in sequence if there is one
-            _nextPattern = (_currentPattern->nextFrameId >= 0) ? 
-                _deviceConfig->GetPatternConfig(_currentPattern->nextFrameId) : nullptr;
-                
+            // Transition complete - make next frame current, and decode the one after it
+            _current = 1 - _current;
+            _currentTiming = _nextTiming;
             _inTransition = false;
+            DecodeNextPattern();
         }
     }
 
+    auto currentPattern = _gammaPatterns[_current];
+    auto nextPattern = _gammaPatterns[1 - _current];
     if (!_inTransition) {
         // Not in transition - just show current frame
-        std::transform(_currentPattern->pixels, _currentPattern->pixels + PIXEL_COUNT, frame.GetBuffer(), [](const neopixel &pixel) { return pixel.gammaCorrected(); });
+        std::copy(currentPattern, currentPattern + PIXEL_COUNT, frame.GetBuffer());
 
-        // If no next frame or no transition time, just keep showing this frame
-        if (_currentPattern->nextFrameId < 0 || _currentPattern->transitionTime == 0) {
-            return _currentPattern->frameTime;
+        // If no next frame, just keep showing this frame
+        if (!_hasNext) {
+            return _currentTiming.frameTime;
         }
 
-        // Time to start transition to next frame
-        if (_nextPattern) {
-            _inTransition = true;
-            _transitionStartTime = frameCounter;
-            _transitionDuration = _currentPattern->transitionTime / 60;
-        }
+        // Time to start transition to next frame. Without a transition time, it cuts straight to the next frame.
+        _inTransition = true;
+        _transitionStartTime = frameCounter;
+        _transitionDuration = (_currentTiming.transitionTime * 60 + 500) / 1000;
         
-        return _currentPattern->frameTime;
+        return _currentTiming.frameTime;
     }
 
 
-    // Blend between current and next frame with gamma correction
+    // Blend between the gamma corrected frames, so the mix is linear in light output
+    auto weight = elapsed * 256 / _transitionDuration;
+    auto buffer = frame.GetBuffer();
     for (size_t i = 0; i < PIXEL_COUNT; i++) {
-        auto currentPixel = _currentPattern->pixels[i].gammaCorrected();
-        auto nextPixel = _nextPattern->pixels[i].gammaCorrected();
-        
-        frame.SetPixel(i, neopixel(
-            (currentPixel.red * (_transitionDuration - elapsed) + nextPixel.red * elapsed) / _transitionDuration,
-            (currentPixel.green * (_transitionDuration - elapsed) + nextPixel.green * elapsed) / _transitionDuration,
-            (currentPixel.blue * (_transitionDuration - elapsed) + nextPixel.blue * elapsed) / _transitionDuration
-        ));
+        buffer[i] = PackedLerp(currentPattern[i].colour, nextPattern[i].colour, weight);
     }
 
     // 60fps during transition 
@@ -2,6 +2,7 @@
 
 #include "IAnimation.h"
 #include "deviceConfig.h"
+#include "PatternSequence.h"
 #include <memory>
 
 class PatternSequenceAnimation : public IAnimation
@@ -12,12 +13,19 @@ public:
     virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override;
 
 private:
-    std::shared_ptr<DeviceConfig> _deviceConfig;
-    uint16_t _currentPatternId;
-    const PatternConfig* _currentPattern;
-    const PatternConfig* _nextPattern;
+    void DecodeNextPattern();
+
+    PatternSequence _sequence;
+
+    // The current and next patterns are decoded into alternate buffers, each with a gamma corrected copy to draw
+    neopixel _patterns[2][PIXEL_COUNT];
+    neopixel _gammaPatterns[2][PIXEL_COUNT];
+    int _current;
+    SequenceFrameTiming _currentTiming;
+    SequenceFrameTiming _nextTiming;
+    bool _hasNext;
+
     uint32_t _transitionStartTime; // Frame counter when the transition started
     uint32_t _transitionDuration; // Duration of the current transition in frames
     bool _inTransition;
 };
-
@@ -2,8 +2,12 @@
 #include "mikuPixel.h"
 #include "PulsingMikuAnimation.h"
 #include "NeoPixelBuffer.h"
+#include "AudioInput.h"
 
-PulsingMikuAnimation::PulsingMikuAnimation()
+PulsingMikuAnimation::PulsingMikuAnimation(uint32_t seed)
+:   _random(seed),
+    _nextBeatPart(0),
+    _beatBlock(0)
 {
     // Initialize pulse parts
     for (size_t i = 0; i < std::size(pulseParts); ++i) {
@@ -13,11 +17,22 @@ PulsingMikuAnimation::PulsingMikuAnimation()
 
 uint32_t PulsingMikuAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frameCounter)
 {
-    // Randomly, approximately every 4 seconds, pulse a part
-    if((random() & 255) == 0)
+    // Pulse to the bass if there's music playing
+    AudioLevels audio;
+    if(ReadAudioLevels(audio) && audio.active)
+    {
+        if(audio.beat && audio.block != _beatBlock)
+        {
+            _beatBlock = audio.block;
+            pulseParts[_nextBeatPart] = 512;
+            _nextBeatPart = (_nextBeatPart + 1) % std::size(AggregatedMikuParts);
+        }
+    }
+    // Otherwise randomly, approximately every 4 seconds, pulse a part
+    else if((_random.Next() & 255) == 0)
     {
         // Find a random part to pulse
-        size_t partIndex = random() % std::size(AggregatedMikuParts);
+        size_t partIndex = _random.Below(std::size(AggregatedMikuParts));
         pulseParts[partIndex] = 512; // Reset the pulse value for this part
     }
 
@@ -2,14 +2,18 @@
 
 #include "IAnimation.h"
 #include "Miku.h"
+#include "FastRandom.h"
 
 class PulsingMikuAnimation : public IAnimation
 {
 public:
-    PulsingMikuAnimation();
+    PulsingMikuAnimation(uint32_t seed = 0);
 
     virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override;
 
 private:
+    FastRandom _random;
     uint32_t pulseParts[std::size(AggregatedMikuParts)];
+    size_t _nextBeatPart; // Beats from the audio input pulse the parts in turn
+    uint32_t _beatBlock;  // Audio block of the last beat, as a block is read by more than one frame
 };
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "IAnimation.h"
+#include "Miku.h"
+#include "MikuPaths.h"
+#include "NeoPixelBuffer.h"
+
+// Rings of light that spread out along the LED runs from random pixels
+class RippleAnimation : public IAnimation
+{
+public:
+    RippleAnimation(uint32_t seed = 0) : _random(seed) {}
+
+    virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override
+    {
+        // Start a new ripple every second
+        if(frameCounter % 60 == 0)
+        {
+            auto &ripple = _ripples[_nextRipple];
+            _nextRipple = (_nextRipple + 1) % std::size(_ripples);
+            FloodFillDistances(_random.Below(PIXEL_COUNT), ripple.distances);
+            ripple.radius = 0;
+        }
+
+        for(auto partIndex = 0; partIndex < std::size(mikuParts); partIndex++)
+        {
+            auto part = mikuParts[partIndex];
+            for(auto idx = part.index; idx < part.index + part.length; idx++)
+            {
+                // Brighten pixels close to the edge of any ripple
+                int intensity = 0;
+                for(auto &ripple : _ripples)
+                {
+                    auto distance = abs(ripple.distances[idx] - ripple.radius);
+                    if(distance < RippleWidth)
+                        intensity += (RippleWidth - distance) * 200 / RippleWidth;
+                }
+                frame.SetPixel(idx, part.colour.fade(std::min(48 + intensity, 255)).gammaCorrected());
+            }
+        }
+
+        for(auto &ripple : _ripples)
+        {
+            if(ripple.radius < UnreachableDistance + RippleWidth)
+                ripple.radius++;
+        }
+
+        return 1000 / 60;
+    }
+
+private:
+    static constexpr int RippleWidth = 4;
+
+    struct Ripple
+    {
+        uint8_t distances[PIXEL_COUNT] = {}; // Distance of each pixel from the origin of the ripple
+        int radius = UnreachableDistance + RippleWidth; // Start inactive
+    };
+
+    FastRandom _random;
+    Ripple _ripples[3];
+    int _nextRipple = 0;
+};
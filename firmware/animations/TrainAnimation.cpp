@@ -6,46 +6,33 @@ TrainPosition::TrainPosition(int startTrack, int maxLength, neopixel colour, Tra
     : _occupancyTracker(occupancyTracker),
     _colour(colour),
     _headTrack(startTrack),
-    _headPosition(MikuTracks[startTrack].start),
     _headDirection(1),
-    _tailTrack(startTrack),
-    _tailPosition(MikuTracks[startTrack].start),
-    _tailDirection(0),
-    _trainLength(0),
-    _maxLength(maxLength),
+    _maxLength(std::clamp(maxLength, 1, MaxTrainLength - 1)), // Leave room for the head to move before the tail is dropped
     _stuckCount(0)
 {
+    // Rear of train is dimmer
+    auto fade = 64;
+    for(auto &shade : _shades)
+    {
+        shade = _colour.fade(fade).gammaCorrected();
+        fade = std::min(fade + 16, 255);
+    }
+
+    _pixels.Push(MikuTracks[startTrack].start);
     _occupancyTracker->Occupy(startTrack);
 }
 
-void TrainPosition::Drive()
+void TrainPosition::Drive(FastRandom &random)
 {
-    auto &currentTrack = MikuTracks[_headTrack];
-    if(currentTrack.IsAtEnd(_headPosition, _headDirection))
+    auto head = _pixels.Back();
+    if(MikuTracks[_headTrack].IsAtEnd(head, _headDirection))
     {
-        if(!SelectNewTrack())
+        if(!SelectNewTrack(random))
         {
             _stuckCount++;
             if(_stuckCount > 60)
             {
-                // Reverse the train
-                //DBG_PRINT("Reversing train at track %d pos %d dir %d\n", _headTrack, _headPosition, _headDirection);
-                std::swap(_headTrack, _tailTrack);
-                std::swap(_headPosition, _tailPosition);
-                std::swap(_headDirection, _tailDirection);
-                std::reverse(_occupiedTracks.begin(), _occupiedTracks.end());
-                // By convention, the tail is not on the occupied tracks list, so remove it and add the new head
-                if(!_occupiedTracks.empty())
-                {
-                    _occupiedTracks.pop_front();
-                    _occupiedTracks.push_back(Connection{_headTrack, _headDirection > 0});
-                }
-                _headDirection = -_headDirection;
-                _tailDirection = -_tailDirection;
-                for(auto &track : _occupiedTracks)
-                {
-                    track.start = !track.start;
-                }
+                Reverse();
                 _stuckCount = 0;
             }
             return; // Stuck, can't move
@@ -54,142 +41,164 @@ void TrainPosition::Drive()
     else
     {
         // Move forward on the current track part
-       _headPosition += _headDirection;
-       _stuckCount = 0;
+        _pixels.Push(head + _headDirection);
+        _stuckCount = 0;
     }
 
-    if(_tailDirection == 0)
-    {
-        // Train is still growing
-        _trainLength++;
-        if(_trainLength == _maxLength)
-            _tailDirection = 1;
-    }
-    else
+    if((int)_pixels.Size() > _maxLength)
     {
-        auto &tailTrack = MikuTracks[_tailTrack];
-        if(tailTrack.IsAtEnd(_tailPosition, _tailDirection))
+        auto tailTrack = MikuPixelTracks[_pixels.Front()];
+        _pixels.PopFront();
+
+        // A train never occupies the same track twice, so we can vacate it once the tail leaves
+        if(MikuPixelTracks[_pixels.Front()] != tailTrack)
         {
-            //DBG_PRINT("Vacating track %d pos %d dir %d\n", _tailTrack, _tailPosition, _tailDirection);
-            // Finished with this track part, vacate it
-            _occupancyTracker->Vacate(_tailTrack);
-            auto &next = _occupiedTracks.front();
-            _tailTrack = next.track;
-            _tailPosition = next.start ? MikuTracks[_tailTrack].start : MikuTracks[_tailTrack].end;
-            _tailDirection = next.start ? 1 : -1;
-
-            _occupiedTracks.pop_front();
-            //DBG_PRINT("Tail now on track %d pos %d dir %d (%d occupied)\n", _tailTrack, _tailPosition, _tailDirection, _occupiedTracks.size());
+            //DBG_PRINT("Vacating track %d\n", tailTrack);
+            _occupancyTracker->Vacate(tailTrack);
         }
-        else
-            _tailPosition += _tailDirection;
     }
 }
 
-bool TrainPosition::SelectNewTrack()
+void TrainPosition::Remove()
+{
+    for(size_t i = 0; i < _pixels.Size(); i++)
+        _occupancyTracker->Vacate(MikuPixelTracks[_pixels[i]]);
+    _pixels.Clear();
+}
+
+void TrainPosition::Reverse()
 {
+    //DBG_PRINT("Reversing train at track %d pos %d dir %d\n", _headTrack, _pixels.Back(), _headDirection);
+    _pixels.Reverse();
+
+    // The old tail becomes the head, heading back the way the tail came from
+    auto head = _pixels.Back();
+    _headTrack = MikuPixelTracks[head];
+    if(_pixels.Size() < 2)
+        _headDirection = -_headDirection;
+    else if(MikuPixelTracks[_pixels[_pixels.Size() - 2]] == _headTrack)
+        _headDirection = head - _pixels[_pixels.Size() - 2];
+    else
+        _headDirection = head == MikuTracks[_headTrack].end ? -1 : 1;
+}
 
+bool TrainPosition::SelectNewTrack(FastRandom &random)
+{
     // At the end of the current track part, need to switch to a connected track
-    std::vector<Connection> validConnections;
+    std::array<Connection, MaxTrackConnections> validConnections;
+    size_t validCount = 0;
     auto possibleConnections = MikuTracks[_headTrack].GetConnections(_headDirection > 0);
-    while(possibleConnections->track >= 0)
+    while(possibleConnections->track >= 0 && validCount < validConnections.size())
     {
         if(!_occupancyTracker->IsOccupied(possibleConnections->track))
-            validConnections.push_back(*possibleConnections);
+            validConnections[validCount++] = *possibleConnections;
         possibleConnections++;
     }
 
-    //DBG_PRINT("At end of track %d pos %d dir %d, %d valid connections\n", _headTrack, _headPosition, _headDirection, validConnections.size());
+    //DBG_PRINT("At end of track %d pos %d dir %d, %d valid connections\n", _headTrack, _pixels.Back(), _headDirection, validCount);
 
-    if(validConnections.size() == 0)
+    if(validCount == 0)
     {
         // No valid connections, stop the train for now
-        //DBG_PRINT("Stuck train at track %d pos %d dir %d\n", _headTrack, _headPosition, _headDirection);
         return false;
-    } 
+    }
 
     // Pick a random valid connection
-    auto connectionIndex = rand() % validConnections.size();
+    auto &connection = validConnections[random.Below(validCount)];
 
     // Move the head to the connected track part
-    _occupiedTracks.push_back(validConnections[connectionIndex]);
-    _headTrack = validConnections[connectionIndex].track;
-    _headPosition = validConnections[connectionIndex].start ? MikuTracks[_headTrack].start : MikuTracks[_headTrack].end;
-    _headDirection = validConnections[connectionIndex].start ? 1 : -1;
+    _headTrack = connection.track;
+    _headDirection = connection.start ? 1 : -1;
+    _pixels.Push(connection.start ? MikuTracks[_headTrack].start : MikuTracks[_headTrack].end);
 
     // Occupy the new track part
-    //DBG_PRINT("Occupied track %d pos %d dir %d (%d occupied)\n", _headTrack, _headPosition, _headDirection, _occupiedTracks.size());
     _occupancyTracker->Occupy(_headTrack);
     return true;
 }
 
-void TrainPosition::Draw(neopixel *buffer)
+void TrainPosition::Draw(neopixel *buffer) const
 {
     // Draw the train on the buffer from tail to head
-    int pos = _tailPosition;
-    int dir = _tailDirection;
-    if(dir == 0)
-        dir = 1; // Still growing, just draw forward
-    int track = _tailTrack;
-    int remainingLength = _trainLength;
+    auto length = _pixels.Size();
+    for(size_t i = 0; i + 1 < length; i++)
+    {
+        buffer[_pixels[i]] = _shades[i];
+    }
 
-    auto nextTrack = _occupiedTracks.begin();
-    auto fade = 64; // Rear of train is dimmer
+    // Front of the train has a bright headlight
+    auto fade = std::min(64 + 16 * (int)(length - 1), 255);
+    buffer[_pixels.Back()] = _colour.fade(fade).blend(neopixel(255, 255, 255), 128).gammaCorrected();
+}
 
-    while(remainingLength > 0)
-    {
-        auto col = _colour.fade(fade);
-        if(remainingLength < 2)
-            col = col.blend(neopixel(255,255,255), 128);
-        buffer[pos] = col.gammaCorrected();
-        fade += 16;
-        if(fade > 255)
-            fade = 255;
-
-        if(MikuTracks[track].IsAtEnd(pos, dir))
-        {
-            if(nextTrack == _occupiedTracks.end())
-                break; // Shouldn't happen, but just in case
 
-            track = nextTrack->track;
-            pos = nextTrack->start ? MikuTracks[track].start : MikuTracks[track].end;
-            dir = nextTrack->start ? 1 : -1;
-            nextTrack++;
-        }
-        else
+static constexpr std::array<AnimationParameter, 1> trainParameters = {{
+    { "trains", ParameterType::Integer, 1, MaxTrains, 3 }
+}};
+
+TrainAnimation::TrainAnimation(int trainCount, uint32_t seed)
+: TunableAnimation(trainParameters),
+  _random(seed),
+  _trainCount(0)
+{
+    _parameters.Initialise(TrainCount, trainCount);
+    SetTrainCount(_parameters[TrainCount]);
+}
+
+bool TrainAnimation::AddTrain()
+{
+    constexpr neopixel colours[] = {
+        neopixel(128, 0, 128),
+        neopixel(0, 128, 128),
+        neopixel(128, 128, 0),
+        neopixel(0, 0, 160),
+        neopixel(160, 32, 0),
+        neopixel(0, 160, 32)
+    };
+    constexpr int lengths[] = { 18, 12, 8, 14, 10, 6 };
+
+    // 5 is co-prime with the track count, so trains started together begin on different tracks.
+    // Trains added later take the next free track.
+    static_assert(std::size(MikuTracks) % 5 != 0 && MaxTrains < std::size(MikuTracks));
+    auto i = _trainCount;
+    for(size_t offset = 0; offset < std::size(MikuTracks); offset++)
+    {
+        auto startTrack = (i * 5 + offset) % std::size(MikuTracks);
+        if(!_occupancyTracker.IsOccupied(startTrack))
         {
-            pos += dir;
+            _trains[i] = TrainPosition(startTrack, lengths[i % std::size(lengths)], colours[i % std::size(colours)], &_occupancyTracker);
+            _trainCount++;
+            return true;
         }
-
-        remainingLength--;
     }
+    return false;
 }
 
-
-TrainAnimation::TrainAnimation()
-: _trains{
-        TrainPosition(0, 18, neopixel(128, 0, 128), &_occupancyTracker),
-        TrainPosition(5, 12, neopixel(0, 128, 128), &_occupancyTracker),
-        TrainPosition(10, 8, neopixel(128, 128, 0), &_occupancyTracker)
-    }
+void TrainAnimation::SetTrainCount(int trainCount)
 {
+    while(_trainCount > trainCount)
+        _trains[--_trainCount].Remove();
+
+    while(_trainCount < trainCount && AddTrain())
+        ;
 }
 
 uint32_t TrainAnimation::DrawFrame(NeoPixelFrame frame, uint32_t frameCounter)
 {
+    if(_parameters.Latch())
+        SetTrainCount(_parameters[TrainCount]);
+
     // Clear the frame
     frame.Clear();
 
-    for(auto &train : _trains)
+    for(auto i = 0; i < _trainCount; i++)
     {
-        train.Drive();
+        _trains[i].Drive(_random);
     }
 
-    for(auto &train : _trains)
+    for(auto i = 0; i < _trainCount; i++)
     {
-        train.Draw(frame.GetBuffer());
+        _trains[i].Draw(frame.GetBuffer());
     }
 
     return 1000 / 30;
 }
-
@@ -4,7 +4,12 @@
 #include "IAnimation.h"
 #include "NeoPixelBuffer.h"
 #include "Miku.h"
-#include <queue>
+#include "RingBuffer.h"
+#include "FastRandom.h"
+#include "AnimationParameters.h"
+
+constexpr int MaxTrainLength = 32;
+constexpr int MaxTrains = 24;
 
 class TrackOccupancyTracker
 {
@@ -32,38 +37,44 @@ private:
 class TrainPosition
 {
 public:
+    TrainPosition() = default;
     TrainPosition(int startTrack, int maxLength, neopixel colour, TrackOccupancyTracker *trackOccupied);
 
-    void Drive();
-    void Draw(neopixel *buffer);
+    void Drive(FastRandom &random);
+    void Draw(neopixel *buffer) const;
+    /// @brief Takes the train off the tracks, vacating every track it is on
+    void Remove();
 
 private:
-    bool SelectNewTrack();
+    bool SelectNewTrack(FastRandom &random);
+    void Reverse();
 
-    TrackOccupancyTracker *_occupancyTracker;
+    TrackOccupancyTracker *_occupancyTracker = nullptr;
     neopixel _colour; // Colour of the train part
-    std::deque<Connection> _occupiedTracks; // Queue of tracks the train part is occupying
-    int _headTrack; // Index of current track part where the the head of the train is
-    int _headPosition; // Position of the head of the train in global pixel index
-    int _headDirection; // Direction of the head of the train in the current track part
-    int _tailTrack; // Index of current track part where the the tail of the train is
-    int _tailPosition; // Position of the tail of the train in global pixel index
-    int _tailDirection; // Direction of the tail of the train in the tail track part
-    int _trainLength; // Number of pixels the train occupies on the track, used to grow train from start
-    int _maxLength; // Maximum length of the train in pixels
-    int _stuckCount; // Count how many times the train has been stuck
+    std::array<neopixel, MaxTrainLength> _shades; // Pre-faded, gamma corrected colour of each pixel, counting from the tail
+    RingBuffer<uint16_t, MaxTrainLength> _pixels; // Pixels the train occupies, from tail to head
+    int _headTrack = 0; // Index of current track part where the the head of the train is
+    int _headDirection = 1; // Direction of the head of the train in the current track part
+    int _maxLength = 0; // Maximum length of the train in pixels
+    int _stuckCount = 0; // Count how many times the train has been stuck
 };
 
-class TrainAnimation : public IAnimation
+class TrainAnimation : public TunableAnimation<1>
 {
 public:
-    TrainAnimation();
+    enum Parameter { TrainCount };
+
+    TrainAnimation(int trainCount = 3, uint32_t seed = 0);
 
     virtual uint32_t DrawFrame(NeoPixelFrame frame, uint32_t frameCounter) override;
 
 private:
+    bool AddTrain();
+    void SetTrainCount(int trainCount);
+
     TrackOccupancyTracker _occupancyTracker;
+    FastRandom _random;
 
-    TrainPosition _trains[3];
+    std::array<TrainPosition, MaxTrains> _trains;
+    int _trainCount;
 };
-
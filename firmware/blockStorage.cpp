@@ -1,141 +1,441 @@
 // Copyright (c) 2025 Mark Godwin.
 // SPDX-License-Identifier: MIT
 
-#include "mikuPixel.h"
+#include "debugPrint.h"
 #include <stdio.h>
-#include "pico/flash.h"
-#include "hardware/flash.h"
 #include <string.h>
+#include <stddef.h>
+#include <algorithm>
 #include "blockStorage.h"
 
 #define BLOCK_FREE 0xFFFFFFFF
 #define BLOCK_EMPTY 0
 
-BlockStorage::BlockStorage(uint32_t base, size_t size, size_t blockSize)
-:   _base(base)
+static constexpr uint32_t PageSize = IFlash::PageSize;
+static constexpr uint32_t SectorSize = IFlash::SectorSize;
+static constexpr uint32_t PagesPerSector = SectorSize / PageSize;
+
+// Every record starts with this header
+struct RecordHeader
+{
+    uint32_t blockId;
+    uint16_t magic;
+    uint16_t length;    // Length of the block data after the header
+    uint32_t sequence;  // Increases with every write, so the newest copy of a block wins
+    uint32_t crc;       // Of the rest of the header and the data, to spot records that were never finished
+};
+
+static constexpr uint16_t RecordMagic = 0x4C42;
+
+static uint32_t Crc32(uint32_t crc, const void *data, size_t size)
+{
+    auto bytes = (const uint8_t *)data;
+    crc = ~crc;
+    while(size--)
+    {
+        crc ^= *bytes++;
+        for(auto bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t RecordCrc(const RecordHeader &header, const uint8_t *data)
+{
+    auto crc = Crc32(0, &header, offsetof(RecordHeader, crc));
+    return Crc32(crc, data, header.length);
+}
+
+/// @brief Copies one page of a record, made up of the header followed by the data
+static void FillRecordPage(uint8_t *page, uint32_t index, const RecordHeader &header, const uint8_t *data)
 {
-    _base = (base / FLASH_SECTOR_SIZE) * FLASH_SECTOR_SIZE;
-    _sectors = (size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
-    _blockPages = (blockSize + 4 + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    ::memset(page, 0, PageSize);
+    uint32_t start = index * PageSize;
+    uint32_t off = 0;
+    if(index == 0)
+    {
+        ::memcpy(page, &header, sizeof(RecordHeader));
+        off = sizeof(RecordHeader);
+    }
+    else
+        start -= sizeof(RecordHeader);
+
+    if(start < header.length)
+        ::memcpy(page + off, data + start, std::min<uint32_t>(header.length - start, PageSize - off));
+}
+
+static bool IsErased(const uint8_t *data, uint32_t size)
+{
+    auto words = (const uint32_t *)data;
+    return std::all_of(words, words + size / sizeof(uint32_t), [](uint32_t word) { return word == 0xFFFFFFFF; });
+}
+
+// Records take as many whole pages as they need, so small configs only use one
+static uint32_t RecordPages(size_t size)
+{
+    return (sizeof(RecordHeader) + size + PageSize - 1) / PageSize;
+}
 
+// Older firmware stored blocks in fixed 8 page slots with only the ID as a header. Nothing shows whether a slot
+// was finished, so they're all moved into the log the first time this firmware starts, and then this block is written.
+static constexpr uint32_t LegacyBlockPages = 8;
+static constexpr uint32_t LegacyHeaderSize = sizeof(uint32_t);
+static constexpr uint32_t MigratedBlockId = 0xFFFFFFFE;
+
+// One erased sector is always kept back, so reclaiming a sector always has somewhere to move its blocks to.
+// Only that can take it, as the sector it empties is erased straight afterwards.
+static constexpr int ReservedSectors = 1;
+// Compaction starts once this few sectors are left, and moves one block on each save
+static constexpr int CollectThreshold = 3;
+// Allocate's result when there's nowhere to put a record
+static constexpr uint32_t NoSpace = UINT32_MAX;
+
+BlockStorage::BlockStorage(IFlash &flash, uint32_t base, size_t size, size_t blockSize)
+:   _flash(flash),
+    _base(base)
+{
+    _base = (base / SectorSize) * SectorSize;
+    _sectors = (size + SectorSize - 1) / SectorSize;
+    _blockPages = std::min<uint32_t>(RecordPages(blockSize), PagesPerSector);
+
+    BuildIndex();
     PrintStorageStats();
+}
 
+uint32_t BlockStorage::BlockSize() const
+{
+    return _blockPages * PageSize - sizeof(RecordHeader);
 }
 
-const uint8_t *BlockStorage::GetBlock(uint32_t blockId) const
+void BlockStorage::GetBlockIds(uint32_t firstId, uint32_t lastId, std::vector<uint32_t> &blockIds) const
 {
-    auto block = FindBlock(blockId);
-    if( block == -1)
-        return nullptr;
+    blockIds.clear();
+    for(auto entry = _index.lower_bound(firstId); entry != _index.end() && entry->first <= lastId; entry++)
+        blockIds.push_back(entry->first);
+}
 
-    // Don't return the header
-    return (uint8_t *)(block + XIP_BASE + sizeof(uint32_t));
+int BlockStorage::SectorOf(uint32_t offset) const
+{
+    return (offset - _base) / SectorSize;
 }
 
-uint32_t BlockStorage::FindBlock(uint32_t blockId) const
+uint32_t BlockStorage::SectorOffset(int sector) const
 {
-    // Search through the pages until we find the block we are looking for...
-    auto offset = _base;
-    auto end = offset + _sectors * FLASH_SECTOR_SIZE - _blockPages * FLASH_PAGE_SIZE + 1;
+    return _base + sector * SectorSize;
+}
 
-    while(offset < end)
+void BlockStorage::BuildIndex()
+{
+    // Blocks from older firmware are only read until they've all been moved into the log, the first time this firmware
+    // starts. After that, anything that looks like one is what's left of an erase that was cut short.
+    std::vector<uint32_t> staleCopies;
+    std::vector<int> legacySectors;
+    ScanSectors(true, staleCopies, legacySectors);
+    auto migrated = _index.count(MigratedBlockId) > 0;
+    if(migrated && !legacySectors.empty())
     {
-        auto id = (uint32_t *)(XIP_BASE + offset);
-        if(*id == blockId)
-            return offset;
-        offset += _blockPages * FLASH_PAGE_SIZE;
+        DBG_PRINT("Ignoring %d sectors in the old format\n", (int)legacySectors.size());
+        ScanSectors(false, staleCopies, legacySectors);
     }
 
-    // We didn't find the block with that ID
-    return -1;
+    // Carry on appending to the sector written most recently
+    for(uint32_t sector = 0; sector < _sectors; sector++)
+    {
+        auto &state = _sectorStates[sector];
+        if(state.usedPages > 0 && state.usedPages < PagesPerSector &&
+            (_headSector < 0 || state.lastSequence > _sectorStates[_headSector].lastSequence))
+            _headSector = sector;
+    }
+
+    // Sectors with nothing live, such as one that was being reclaimed when the power went, are erased straight away.
+    // Otherwise the storage could start with no erased sector for the compaction to move blocks to.
+    for(uint32_t sector = 0; sector < _sectors; sector++)
+    {
+        auto &state = _sectorStates[sector];
+        if((int)sector != _headSector && state.usedPages > 0 && state.livePages == 0)
+        {
+            DBG_PRINT("Erasing storage sector %d, which has nothing live\n", sector);
+            _writes.push_back({ FlashStep::Erase, SectorOffset(sector), nullptr, 0 });
+            state = {};
+        }
+    }
+
+    // A save or a move was interrupted after the new copy was written. Finish it off, so deleting the block
+    // later can't bring the old copy back.
+    for(auto offset : staleCopies)
+    {
+        if(_sectorStates[SectorOf(offset)].usedPages == 0)
+            continue;
+        DBG_PRINT("Invalidating old copy at 0x%08x\n", offset);
+        Invalidate(offset);
+    }
+
+    if(!migrated)
+        MigrateLegacyBlocks(legacySectors);
 }
 
+void BlockStorage::ScanSectors(bool acceptLegacy, std::vector<uint32_t> &staleCopies, std::vector<int> &legacySectors)
+{
+    _index.clear();
+    _sectorStates.assign(_sectors, SectorState{});
+    _headSector = -1;
+    _collectSector = -1;
+    _nextSequence = 1;
+    staleCopies.clear();
+    legacySectors.clear();
+
+    for(uint32_t sector = 0; sector < _sectors; sector++)
+    {
+        auto &state = _sectorStates[sector];
+        uint32_t page = 0;
+        while(page < PagesPerSector)
+        {
+            auto offset = SectorOffset(sector) + page * PageSize;
+            auto header = (const RecordHeader *)_flash.Map(offset);
+
+            // Records are appended in order, so the rest of the sector should be erased. If it isn't, a write was cut
+            // short before the record ID was written. Nothing more can be written here until the sector is erased.
+            if(header->blockId == BLOCK_FREE)
+            {
+                if(!IsErased(_flash.Map(offset), (PagesPerSector - page) * PageSize))
+                {
+                    DBG_PRINT("Unfinished write in storage sector %d\n", sector);
+                    page = PagesPerSector;
+                }
+                break;
+            }
 
-void BlockStorage::SaveBlock(uint32_t blockId, const uint8_t *data, size_t size)
+            BlockLocation location = { offset, 0, (uint16_t)LegacyBlockPages, (uint16_t)LegacyHeaderSize };
+            if(header->magic == RecordMagic)
+            {
+                location.sequence = header->sequence;
+                location.pages = RecordPages(header->length);
+                location.headerSize = sizeof(RecordHeader);
+            }
+            auto legacy = header->magic != RecordMagic;
+            if(location.pages > PagesPerSector - page || (legacy && (!acceptLegacy || page % LegacyBlockPages)))
+            {
+                // There's no telling where the next record starts
+                DBG_PRINT("Corrupt record in storage sector %d\n", sector);
+                page = PagesPerSector;
+                break;
+            }
+            page += location.pages;
+
+            if(legacy && (legacySectors.empty() || legacySectors.back() != (int)sector))
+                legacySectors.push_back(sector);
+
+            state.lastSequence = std::max(state.lastSequence, location.sequence);
+            _nextSequence = std::max(_nextSequence, location.sequence + 1);
+
+            if(header->blockId == BLOCK_EMPTY)
+                continue;
+
+            // A record with a bad CRC was cut short while its ID or its invalidation was being written.
+            // Either way the other copy of the block, if there is one, is the one to keep.
+            if(location.headerSize == sizeof(RecordHeader) && header->crc != RecordCrc(*header, (const uint8_t *)(header + 1)))
+            {
+                DBG_PRINT("Bad CRC for record %08x in storage sector %d\n", header->blockId, sector);
+                continue;
+            }
+
+            // Only the newest copy of a block is live
+            auto existing = _index.find(header->blockId);
+            if(existing != _index.end())
+            {
+                if(existing->second.sequence >= location.sequence)
+                {
+                    staleCopies.push_back(offset);
+                    continue;
+                }
+                staleCopies.push_back(existing->second.offset);
+                DropLocation(existing->second);
+            }
+            _index[header->blockId] = location;
+            state.livePages += location.pages;
+        }
+        state.usedPages = page;
+    }
+}
+
+void BlockStorage::MigrateLegacyBlocks(const std::vector<int> &legacySectors)
 {
-    // Find a free block to store our data
-    auto freeBlock = FindBlock(BLOCK_FREE);
-    if(freeBlock == -1)
+    // This only happens once, so it's done straight away, a sector at a time so only one sector's blocks are held in RAM
+    for(auto sector : legacySectors)
     {
-        DBG_PUT("No free blocks found");
+        auto &state = _sectorStates[sector];
+        if(state.usedPages == 0)
+            continue;
 
-        // If there are no free blocks, try to reformat all contiguous empty sectors.
-        FormatEmptySectors();
-        freeBlock = FindBlock(BLOCK_FREE);
-        if(freeBlock == -1)
+        // Nothing more can go in a sector that's being emptied
+        if(sector == _headSector)
         {
-            DBG_PUT("ERROR: Still no free blocks found");
+            state.usedPages = PagesPerSector;
+            _headSector = -1;
+        }
+
+        DBG_PRINT("Moving blocks from older firmware out of sector %d\n", sector);
+        _collectSector = sector;
+        while(_collectSector >= 0)
+        {
+            if(!CollectStep(WriteReason::Collect))
+                break;
+        }
+        Flush();
+        if(_collectSector >= 0 || !_writes.empty())
+        {
+            DBG_PUT("ERROR: Couldn't move the blocks from older firmware. They'll be moved on the next start.");
             return;
         }
     }
 
-    DBG_PRINT("Free block found at 0x%08x\n", freeBlock);
+    // Only written once everything has been moved, so losing power part way through just means starting again
+    DBG_PUT("Storage is all in the current format");
+    uint8_t nothing = 0;
+    WriteRecord(MigratedBlockId, &nothing, 0, WriteReason::Save);
+}
+
+const uint8_t *BlockStorage::GetBlock(uint32_t blockId, size_t *size) const
+{
+    auto entry = _index.find(blockId);
+    if(entry == _index.end())
+        return nullptr;
 
-    // First find any existing block and "delete" it by nulling out it's first page
-    auto existing = FindBlock(blockId);
-    if(existing != -1)
+    auto &location = entry->second;
+    auto record = RecordStart(location);
+    if(size)
     {
-        DBG_PRINT("Deleting existing record at 0x%08x\n", existing);
-        DeletePage(existing);
+        // Blocks from older firmware don't record their length, so they're taken to fill their slot
+        if(location.headerSize == sizeof(RecordHeader))
+            *size = ((const RecordHeader *)record)->length;
+        else
+            *size = std::min<uint32_t>(location.pages * PageSize - location.headerSize, BlockSize());
     }
 
-    // Finally, save the block in the free location
-    struct PgmData
+    // Don't return the header
+    return record + location.headerSize;
+}
+
+const uint8_t *BlockStorage::RecordStart(const BlockLocation &location) const
+{
+    // Records still waiting to be written are read from their copy in RAM
+    auto pending = _pendingRecords.find(location.offset);
+    if(pending != _pendingRecords.end())
+        return pending->second->data();
+    return _flash.Map(location.offset);
+}
+
+void BlockStorage::SaveBlock(uint32_t blockId, const uint8_t *data, size_t size)
+{
+    if(size > BlockSize())
     {
-        uint32_t blockId;
-        uint32_t offset;
-        const uint8_t *data;
-        size_t size;
-    };
-    PgmData d = {blockId, freeBlock, data, size};
-
-    DBG_PRINT("Flashing new record at... 0x%08x (0x%08x)\n", d.offset, d.size);
-    auto result = flash_safe_execute([](void *p) {
-        // Copy the first pages directly
-        auto params = (PgmData *)p;
-
-        uint8_t tmpPage[FLASH_PAGE_SIZE];
-
-        // The first page includes the ID
-        *(uint32_t *)tmpPage = params->blockId;
-        uint8_t off = sizeof(uint32_t); // Offset into the page buffer
-        uint32_t space = FLASH_PAGE_SIZE - off;
-        while(params->size)
-        {
-            auto bytes = params->size > space ? space : params->size;
-            ::memcpy(tmpPage + off, params->data, bytes);
-            params->size -= bytes;
-            params->data += bytes;
-            space -= bytes;
-            off += bytes;
-            if(space > 0)
-                ::memset(tmpPage + off, 0, space);
-
-            flash_range_program(params->offset, tmpPage, sizeof(tmpPage));
-            params->offset += sizeof(tmpPage);
-            off = 0; // Next page has no header
-            space = sizeof(tmpPage);
-        }
+        DBG_PRINT("Block %08x is too big to save (%d bytes)\n", blockId, (int)size);
+        return;
+    }
+    _writtenRecords.clear();
+
+    if(!WriteRecord(blockId, data, size, WriteReason::Save))
+        return;
+
+    // Do a little of the compaction on each save, rather than holding up a save for a whole sector when space runs out.
+    // With plenty of space, sectors that haven't been written for a long time are moved instead, so they take their share of the wear.
+    // A step that would need the reserved sector waits, and the next save that runs short reclaims the whole sector instead.
+    if(_collectSector < 0)
+        _collectSector = ErasedSectors() <= CollectThreshold ? MostReclaimableSector(true) : ColdSector();
+    if(_collectSector >= 0)
+        CollectStep(WriteReason::Compact);
+}
 
-    }, &d, 10000);
-    if(result != PICO_OK)
+bool BlockStorage::WriteRecord(uint32_t blockId, const uint8_t *data, size_t size, WriteReason reason)
+{
+    auto pages = RecordPages(size);
+    auto offset = Allocate(pages, reason);
+    if(offset == NoSpace)
     {
-        DBG_PRINT("Write failed (%d)\n", result);
+        if(reason != WriteReason::Compact)
+            DBG_PUT("ERROR: No space left in storage");
+        return false;
     }
-    else
+
+    RecordHeader header = {blockId, RecordMagic, (uint16_t)size, _nextSequence++, 0};
+    header.crc = RecordCrc(header, data);
+
+    // The whole record is copied, so it can be read back until it's been written
+    auto record = std::make_shared<std::vector<uint8_t>>(pages * PageSize);
+    for(uint32_t page = 0; page < pages; page++)
+        FillRecordPage(record->data() + page * PageSize, page, header, data);
+    _pendingRecords[offset] = record;
+
+    // The pages are written last to first, and the ID goes in on its own at the very end. A record is only
+    // found at startup once it has an ID, and then the CRC shows whether it was finished.
+    DBG_PRINT("Queueing new record at... 0x%08x (0x%08x)\n", offset, (int)size);
+    for(auto page = pages; page-- > 0; )
+        _writes.push_back({ FlashStep::Program, offset + page * PageSize, record, page * PageSize });
+    _writes.push_back({ FlashStep::Commit, offset, record, 0 });
+
+    auto &sector = _sectorStates[SectorOf(offset)];
+    sector.lastSequence = header.sequence;
+    sector.livePages += pages;
+
+    // The old copy is only invalidated once the new one is written
+    auto existing = _index.find(blockId);
+    if(existing != _index.end())
     {
-        DBG_PRINT("Write Finished (%d)\n", result);
+        DBG_PRINT("Deleting existing record at 0x%08x\n", existing->second.offset);
+        Invalidate(existing->second.offset);
+        DropLocation(existing->second);
     }
+    _index[blockId] = { offset, header.sequence, (uint16_t)pages, (uint16_t)sizeof(RecordHeader) };
+    return true;
+}
+
+uint32_t BlockStorage::Allocate(uint32_t pages, WriteReason reason)
+{
+    auto headHasRoom = [&]() { return HeadFreePages() >= pages; };
+
+    // Saves can't take the reserved sector, so reclaim whole sectors first if that's all that's left
+    if(reason == WriteReason::Save)
+    {
+        for(uint32_t attempt = 0; attempt < _sectors && !headHasRoom() && ErasedSectors() <= ReservedSectors; attempt++)
+        {
+            if(!CollectSector())
+                break;
+        }
+    }
+
+    if(!headHasRoom())
+    {
+        if(reason != WriteReason::Collect && ErasedSectors() <= ReservedSectors)
+            return NoSpace;
+
+        auto sector = NextErasedSector();
+        if(sector < 0)
+            return NoSpace;
+
+        // Whatever is left at the end of the old sector is reclaimed with it
+        if(_headSector >= 0)
+            _sectorStates[_headSector].usedPages = PagesPerSector;
 
+        DBG_PRINT("Starting storage sector %d\n", sector);
+        _headSector = sector;
+    }
+
+    auto &head = _sectorStates[_headSector];
+    auto offset = SectorOffset(_headSector) + head.usedPages * PageSize;
+    head.usedPages += pages;
+    return offset;
 }
 
 void BlockStorage::ClearBlock(uint32_t blockId)
 {
-    auto existing = FindBlock(blockId);
-    if(existing != -1)
+    _writtenRecords.clear();
+    auto existing = _index.find(blockId);
+    if(existing != _index.end())
     {
-        DBG_PRINT("Deleting existing record at 0x%08x\n", existing);
-        DeletePage(existing);
+        DBG_PRINT("Deleting existing record at 0x%08x\n", existing->second.offset);
+        Invalidate(existing->second.offset);
+        DropLocation(existing->second);
+        _index.erase(existing);
     }
     else
     {
@@ -143,121 +443,273 @@ void BlockStorage::ClearBlock(uint32_t blockId)
     }
 }
 
-void BlockStorage::Format()
+void BlockStorage::DropLocation(const BlockLocation &location)
 {
-    DBG_PRINT("Formatting entire block storage: 0x%08x - 0x%08x\n", _base, _sectors * FLASH_SECTOR_SIZE);
-    auto result = flash_safe_execute([](void *p) {
-        auto pthis = (BlockStorage *)p;
-        flash_range_erase(pthis->_base, pthis->_sectors * FLASH_SECTOR_SIZE);
-    }, this, 1000);
+    _sectorStates[SectorOf(location.offset)].livePages -= location.pages;
+}
 
-    if(result == PICO_OK)
-        DBG_PUT("Formatting complete");
-    else
-        DBG_PRINT("Format failed (%d)\n", result);
+void BlockStorage::Invalidate(uint32_t offset)
+{
+    _writes.push_back({ FlashStep::Invalidate, offset, nullptr, 0 });
 }
 
-void BlockStorage::PrintStorageStats()
+uint32_t BlockStorage::NextWriteTime() const
 {
-    // Print statistics about the block storage...
-    auto offset = _base;
-    auto end = offset + _sectors * FLASH_SECTOR_SIZE - _blockPages * FLASH_PAGE_SIZE + 1;
+    if(_writes.empty())
+        return 0;
+    return _writes.front().step == FlashStep::Erase ? IFlash::SectorEraseTime : IFlash::PageProgramTime;
+}
 
-    auto usedCount = 0;
-    auto freeCount = 0;
-    auto clearedCount = 0;
-    auto clearedSectors = 0;    // Number of sectors cleared and ready for reformat
+bool BlockStorage::WriteNext()
+{
+    if(_writes.empty())
+        return true;
 
-    uint32_t emptyStart = offset;
+    auto &write = _writes.front();
+    uint8_t page[PageSize];
 
-    while(offset < end)
+    int result;
+    if(write.step == FlashStep::Erase)
     {
-        auto id = (uint32_t *)(XIP_BASE + offset);
-        if(*id == 0)
+        result = _flash.Erase(write.offset, SectorSize);
+    }
+    else
+    {
+        switch(write.step)
         {
-            // A previously cleared block
-            clearedCount++;
+            case FlashStep::Program:
+                ::memcpy(page, write.record->data() + write.recordOffset, PageSize);
+                if(write.recordOffset == 0)
+                    ::memset(page, 0xFF, sizeof(uint32_t));  // The ID is written last
+                break;
+
+            case FlashStep::Commit:
+                ::memset(page, 0xFF, PageSize);
+                ::memcpy(page, write.record->data(), sizeof(uint32_t));
+                break;
+
+            default:
+                // Only the ID is cleared, so the rest of the header still says how long the record is
+                ::memset(page, 0xFF, PageSize);
+                ::memset(page, 0, sizeof(uint32_t));
+                break;
         }
-        else
-        {
-            auto emptySectorStart = (emptyStart - _base + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
-            auto emptySectorEnd = (offset - _base) / FLASH_SECTOR_SIZE;
-            if(emptySectorStart < emptySectorEnd)
-                clearedSectors += (emptySectorEnd - emptySectorStart);
 
-            emptyStart = offset + _blockPages * FLASH_PAGE_SIZE;
-            if(*id == 0xFFFFFFFF)
-            {
-                // A clean formatted block
-                freeCount++;
-            }
-            else
-            {
-                // A block with data
-                usedCount++;
-            }
+        result = _flash.Program(write.offset, page, PageSize);
+    }
+
+    if(result != IFlash::Ok)
+    {
+        DBG_PRINT("Flash write failed at 0x%08x (%d)\n", write.offset, result);
+        return false;
+    }
+
+    // Once a record is complete in flash, it's read from there. The copy is kept until the next save, in case it's still in use.
+    if(write.step == FlashStep::Commit)
+    {
+        auto pending = _pendingRecords.find(write.offset);
+        if(pending != _pendingRecords.end() && pending->second == write.record)
+        {
+            _writtenRecords.push_back(std::move(pending->second));
+            _pendingRecords.erase(pending);
         }
-        offset += _blockPages * FLASH_PAGE_SIZE;
     }
 
-    printf("Storage statistics:\n    Sectors:  %d\n    Blocks:   %d\n    Used:     %d\n    Free:     %d\n    Del:      %d\n    Del Sect: %d\n\n", _sectors, (_sectors * FLASH_SECTOR_SIZE) / (_blockPages * FLASH_PAGE_SIZE), usedCount, freeCount, clearedCount, clearedSectors);
+    _writes.pop_front();
+    return true;
 }
 
-void BlockStorage::DeletePage(uint32_t pageOffset)
+void BlockStorage::Flush()
 {
-    flash_safe_execute( [](void *pg) {
+    if(!_writes.empty())
+        DBG_PRINT("Flushing %d flash writes\n", (int)_writes.size());
 
-        auto offset = (uint32_t)pg;
-        uint8_t zeros[FLASH_PAGE_SIZE];
-        ::memset(zeros, 0, FLASH_PAGE_SIZE);
-        flash_range_program(offset, zeros, sizeof(zeros));
-    }, (void *)pageOffset, 1000);
+    auto failures = 0;
+    while(!_writes.empty() && failures < 10)
+    {
+        if(WriteNext())
+            failures = 0;
+        else
+            failures++;
+    }
 }
 
-void BlockStorage::FormatEmptySectors()
+int BlockStorage::ErasedSectors() const
 {
+    return std::count_if(_sectorStates.begin(), _sectorStates.end(), [](const SectorState &state) { return state.usedPages == 0; });
+}
 
-    // Iterate through the blocks, keeping track of fully empty pages
-    auto offset = 0;
-    auto end = _sectors * FLASH_SECTOR_SIZE;
+int BlockStorage::NextErasedSector() const
+{
+    // Take the sectors in turn after the last one written, so the erases are spread over all of them
+    for(uint32_t i = 1; i <= _sectors; i++)
+    {
+        auto sector = (_headSector + i) % _sectors;
+        if(_sectorStates[sector].usedPages == 0 && (int)sector != _collectSector)
+            return sector;
+    }
+    return -1;
+}
+
+uint32_t BlockStorage::HeadFreePages() const
+{
+    return _headSector >= 0 ? PagesPerSector - _sectorStates[_headSector].usedPages : 0;
+}
+
+// Which of a sector's records to move next: the biggest that fits in what's left of the head, so the end of the head
+// isn't wasted, or the biggest of all if none of them fit
+static size_t NextToMove(const std::vector<uint16_t> &pages, uint32_t headFree)
+{
+    size_t best = 0;
+    for(size_t i = 1; i < pages.size(); i++)
+    {
+        auto fits = pages[i] <= headFree;
+        auto bestFits = pages[best] <= headFree;
+        if(fits != bestFits ? fits : pages[i] > pages[best])
+            best = i;
+    }
+    return best;
+}
 
-    // Assume the first sector is empty
-    auto emptySectorStart = 0;
+int BlockStorage::MostReclaimableSector(bool canStartSector) const
+{
+    std::vector<std::vector<uint16_t>> sectorRecords(_sectors);
+    for(auto &entry : _index)
+        sectorRecords[SectorOf(entry.second.offset)].push_back(entry.second.pages);
 
-    while(offset < end)
+    auto best = -1;
+    auto bestReclaimed = 0;
+    for(uint32_t sector = 0; sector < _sectors; sector++)
     {
-        if(*(uint32_t *)(XIP_BASE + _base + offset) != BLOCK_EMPTY)
+        auto &state = _sectorStates[sector];
+        int reclaimed = state.usedPages - state.livePages;
+        if((int)sector == _headSector || state.usedPages == 0 || reclaimed == 0)
+            continue;
+
+        // Moving the blocks out wastes whatever is left at the end of a sector when the next one doesn't fit.
+        // Without that, sectors could be moved back and forth for nothing.
+        auto &pages = sectorRecords[sector];
+        auto headFree = HeadFreePages();
+        while(!pages.empty() && reclaimed > 0)
         {
-            // We know the current sector is not empty
-            auto emptySectorEnd = offset / FLASH_SECTOR_SIZE;
+            auto next = NextToMove(pages, headFree);
+            if(pages[next] > headFree)
+            {
+                reclaimed = canStartSector ? reclaimed - headFree : 0;
+                headFree = PagesPerSector;
+            }
+            headFree -= pages[next];
+            pages.erase(pages.begin() + next);
+        }
+
+        // Of the sectors with as much to reclaim, take the one written longest ago
+        if(reclaimed > bestReclaimed || (reclaimed > 0 && reclaimed == bestReclaimed && state.lastSequence < _sectorStates[best].lastSequence))
+        {
+            best = sector;
+            bestReclaimed = reclaimed;
+        }
+    }
+    return best;
+}
+
+int BlockStorage::ColdSector() const
+{
+    // Anything not rewritten in the time it takes to write the whole storage over is moved
+    auto coldAge = _sectors * PagesPerSector;
+    auto best = -1;
+    for(uint32_t sector = 0; sector < _sectors; sector++)
+    {
+        auto &state = _sectorStates[sector];
+        if((int)sector != _headSector && state.usedPages > 0 && _nextSequence - state.lastSequence > coldAge &&
+            (best < 0 || state.lastSequence < _sectorStates[best].lastSequence))
+            best = sector;
+    }
+    return best;
+}
 
-            // If there were empty sectors up to this sector, format them
-            if(emptySectorEnd > emptySectorStart)
-                FormatSectors(emptySectorStart, emptySectorEnd - emptySectorStart);
+bool BlockStorage::CollectSector()
+{
+    // Any sector's blocks fit in an erased one. Without one, such as after losing power while a sector was being
+    // reclaimed, only a sector whose blocks fit in what's left of the head can be.
+    if(_collectSector < 0)
+        _collectSector = MostReclaimableSector(ErasedSectors() > 0);
+    if(_collectSector < 0)
+        return false;
+
+    while(_collectSector >= 0)
+    {
+        if(!CollectStep(WriteReason::Collect))
+            return false;
+    }
+    return true;
+}
 
-            // Assume the next sector _after_ the end of this block is empty until we know otherwise
-            emptySectorStart = emptySectorEnd + 1;
+bool BlockStorage::CollectStep(WriteReason reason)
+{
+    auto sector = _collectSector;
+    std::vector<uint32_t> blockIds;
+    std::vector<uint16_t> pages;
+    for(auto &entry : _index)
+    {
+        if(SectorOf(entry.second.offset) == sector)
+        {
+            blockIds.push_back(entry.first);
+            pages.push_back(entry.second.pages);
         }
-        offset += _blockPages * FLASH_PAGE_SIZE;
     }
 
-    // Format the remaining empty blocks at the end of the storage
-    if(_sectors > emptySectorStart)
-        FormatSectors(emptySectorStart, _sectors - emptySectorStart);
+    if(!blockIds.empty())
+    {
+        // Flash can't be read while it's being programmed, so the block is copied out first.
+        // Blocks from older firmware may be a little bigger than a block now, but only ever held padding at the end.
+        auto blockId = blockIds[NextToMove(pages, HeadFreePages())];
+        auto location = _index[blockId];
+        auto start = RecordStart(location);
+        auto size = std::min<uint32_t>(location.pages * PageSize - location.headerSize, BlockSize());
+        if(location.headerSize == sizeof(RecordHeader))
+            size = ((const RecordHeader *)start)->length;
+        auto data = start + location.headerSize;
+        std::vector<uint8_t> copy(data, data + size);
+
+        DBG_PRINT("Moving block %08x out of sector %d\n", blockId, sector);
+        return WriteRecord(blockId, copy.data(), copy.size(), reason);
+    }
+
+    // Nothing live is left, so the sector can be reused. Writes are done in order, so it's erased before anything new goes in it.
+    DBG_PRINT("Erasing storage sector %d\n", sector);
+    _writes.push_back({ FlashStep::Erase, SectorOffset(sector), nullptr, 0 });
+    _sectorStates[sector] = {};
+    _collectSector = -1;
+    return true;
 }
 
+void BlockStorage::Format()
+{
+    DBG_PRINT("Formatting entire block storage: 0x%08x - 0x%08x\n", _base, _sectors * SectorSize);
+    _writes.clear();
+    _pendingRecords.clear();
+    _writtenRecords.clear();
 
-void BlockStorage::FormatSectors(int sector, int count)
+    auto result = _flash.Erase(_base, _sectors * SectorSize);
+
+    if(result == IFlash::Ok)
+        DBG_PUT("Formatting complete");
+    else
+        DBG_PRINT("Format failed (%d)\n", result);
+
+    BuildIndex();
+}
+
+void BlockStorage::PrintStorageStats()
 {
-    DBG_PRINT("Formatting sectors %d to %d\n", sector, sector + count - 1);
-    struct FmtParams
+    auto livePages = 0;
+    auto deadPages = 0;
+    for(auto &state : _sectorStates)
     {
-        uint32_t base;
-        uint32_t size;
-    };
-    FmtParams params = { _base + sector * FLASH_SECTOR_SIZE,  count * FLASH_SECTOR_SIZE };
-    flash_safe_execute( [] (void *p) {
-        auto params = (FmtParams *)p;
-        flash_range_erase(params->base, params->size);
-    }, &params, 1000);
-}
\ No newline at end of file
+        livePages += state.livePages;
+        deadPages += state.usedPages - state.livePages;
+    }
+
+    printf("Storage statistics:\n    Sectors:  %d\n    Erased:   %d\n    Blocks:   %d\n    Live:     %d pages\n    Dead:     %d pages\n    Sequence: %d\n    Queued:   %d writes\n\n",
+        _sectors, ErasedSectors(), (int)_index.size(), livePages, deadPages, _nextSequence, (int)_writes.size());
+}
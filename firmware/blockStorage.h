@@ -3,21 +3,38 @@
 
 #pragma once
 
+#include "IFlash.h"
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
 
-/// @brief Trivial and extremely limited flash block storage with rudimentary wear leveling
+/// @brief Log structured flash block storage with compaction and wear leveling
+/// @remarks Blocks are appended to the sector being written, each with a sequence number so the newest copy of a block
+/// always wins. Saving a block writes the new copy, with a CRC, before the old one is invalidated, so losing power part
+/// way through leaves either the old or the new copy. Sectors are reclaimed a step at a time as blocks are saved, by
+/// moving the live blocks out of the sector with the most dead space and then erasing it.
+///
+/// Blocks saved by older firmware, in fixed slots, are moved into the log the first time this firmware starts.
+///
+/// Saves only queue up the flash writes, which are done a page or a sector erase at a time with WriteNext. Saved blocks
+/// are read back from RAM until they've been written.
 class BlockStorage
 {
 public:
     /// @brief Initialize the block storage
-    /// @param base Base address in flash for block storage - must be multiple of FLASH_SECTOR_SIZE (4096)
-    /// @param size size of the block storage - must be multiple of FLASH_SECTOR_SIZE (4096)
-    /// @param blockSize max size of each block (will be rounded up to multiples of FLASH_PAGE_SIZE - 4)
-    BlockStorage(uint32_t base, size_t size, size_t blockSize);
+    /// @param flash The flash to store the blocks in
+    /// @param base Base address in flash for block storage - must be a multiple of IFlash::SectorSize (4096)
+    /// @param size size of the block storage - must be a multiple of IFlash::SectorSize (4096)
+    /// @param blockSize max size of each block. Each block only takes the whole pages it needs, including the record header.
+    BlockStorage(IFlash &flash, uint32_t base, size_t size, size_t blockSize);
 
     /// @brief Returns a pointer to the block
     /// @param blockId Id of the previously stored block
+    /// @param size [out] optional, set to the size the block was saved with
     /// @return the stored block data (a pointer directly into flash memory). It can't be modified!
-    const uint8_t *GetBlock(uint32_t blockId) const;
+    /// It's only valid until the next block is saved or cleared, as saving may move other blocks.
+    const uint8_t *GetBlock(uint32_t blockId, size_t *size = nullptr) const;
 
     /// @brief Stores a block in flash, overwriting any previous block with that ID
     /// @param blockId Id of the block to store
@@ -32,18 +49,100 @@ public:
     /// @brief Formats (clears) the entire block storage. DANGER!
     void Format();
 
-    uint32_t BlockSize() { return _blockPages * 256 - 4; }
+    uint32_t BlockSize() const;
+
+    /// @brief Lists the stored blocks with IDs in a range, from the index so nothing is read from flash
+    /// @param blockIds [out] the IDs found, in order
+    void GetBlockIds(uint32_t firstId, uint32_t lastId, std::vector<uint32_t> &blockIds) const;
+
+    /// @brief Roughly how long the next queued flash write will hold up the other core, in microseconds
+    /// @return 0 if everything has been written
+    uint32_t NextWriteTime() const;
+
+    /// @brief Does the next queued flash write: one page, or one sector erase
+    /// @return false if the write failed. It stays at the front of the queue to try again.
+    bool WriteNext();
+
+    /// @brief Does all the queued flash writes now, such as before rebooting
+    void Flush();
 
     void PrintStorageStats();
 
 private:
-    uint32_t FindBlock(uint32_t blockId) const;
-    void DeletePage(uint32_t pageOffset);
+    struct BlockLocation
+    {
+        uint32_t offset;        // Offset of the record header in flash
+        uint32_t sequence;
+        uint16_t pages;         // Pages taken by the record
+        uint16_t headerSize;    // Blocks from older firmware have a shorter header
+    };
+
+    enum class FlashStep : uint8_t
+    {
+        Program,    // One page of a record, without its ID
+        Commit,     // The ID of a record, once all its pages are written
+        Invalidate, // Clear the ID of an old record
+        Erase       // A whole sector
+    };
+
+    struct FlashWrite
+    {
+        FlashStep step;
+        uint32_t offset;
+        std::shared_ptr<const std::vector<uint8_t>> record;    // The whole record, for Program and Commit
+        uint32_t recordOffset;                                  // Offset of the page in the record
+    };
+
+    // What a record is written for, which decides whether it can take the last erased sector
+    enum class WriteReason : uint8_t
+    {
+        Save,       // A block being saved
+        Compact,    // Moving a block out of a sector a step at a time, as blocks are saved
+        Collect     // Moving a block while a whole sector is reclaimed at once
+    };
 
-    void FormatEmptySectors();
-    void FormatSectors(int sectorNumber, int count);
+    struct SectorState
+    {
+        uint16_t usedPages;     // Pages written, in order from the start of the sector. 0 if it's erased.
+        uint16_t livePages;     // Pages holding the current copy of a block
+        uint32_t lastSequence;  // Sequence of the newest record, to find sectors holding data that never changes
+    };
 
+    void BuildIndex();
+    void ScanSectors(bool acceptLegacy, std::vector<uint32_t> &staleCopies, std::vector<int> &legacySectors);
+    void MigrateLegacyBlocks(const std::vector<int> &legacySectors);
+    const uint8_t *RecordStart(const BlockLocation &location) const;
+
+    bool WriteRecord(uint32_t blockId, const uint8_t *data, size_t size, WriteReason reason);
+    uint32_t Allocate(uint32_t pages, WriteReason reason);
+    void Invalidate(uint32_t offset);
+    void DropLocation(const BlockLocation &location);
+
+    int ErasedSectors() const;
+    int NextErasedSector() const;
+    uint32_t HeadFreePages() const;
+    int MostReclaimableSector(bool canStartSector) const;
+    int ColdSector() const;
+    bool CollectSector();
+    bool CollectStep(WriteReason reason);
+
+    int SectorOf(uint32_t offset) const;
+    uint32_t SectorOffset(int sector) const;
+
+    IFlash &_flash;
     uint32_t _base;         // Base address of storage
     uint32_t _sectors;      // Number of sectors allocated to storage
-    uint32_t _blockPages;   // Number of pages in each block
+    uint32_t _blockPages;   // Number of pages in the largest block
+
+    // Where the current copy of each block is, so lookups don't scan the flash. Built at startup, and kept up to date by every write.
+    std::map<uint32_t, BlockLocation> _index;
+    std::vector<SectorState> _sectorStates;
+    int _headSector;        // Sector new records are appended to, or -1 to start a new one
+    int _collectSector;     // Sector being emptied by the compaction, or -1
+    uint32_t _nextSequence;
+
+    std::deque<FlashWrite> _writes;
+    // Records waiting to be written, by offset, and the ones written since the last save that may still be in use
+    std::map<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> _pendingRecords;
+    std::vector<std::shared_ptr<const std::vector<uint8_t>>> _writtenRecords;
 };
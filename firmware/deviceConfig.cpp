@@ -6,178 +6,408 @@
 #include <string.h>
 #include <stdlib.h>
 #include "pico/flash.h"
-#include "pico/malloc.h"
 
 #include "deviceConfig.h"
 #include "blockStorage.h"
+#include "PatternCodec.h"
+#include <algorithm>
 
 static const uint32_t wifiConfigMagic = 0x19841984;
 static const uint32_t mqttConfigMagic = 0x19841985;
 static const uint32_t lightConfigMagic = 0x19841977;
-static const uint32_t patternsConfigMagic = 0xDEADBEEF;
+static const uint32_t patternsConfigMagic = 0xDEADBEEF; // The old list of pattern IDs. Only looked for to clear it.
 static const uint32_t patternConfigMagic = 0xBEEF0000;
+static const uint32_t effectConfigMagic = 0xEFFE0000;
+static const uint32_t sequenceConfigMagic = 0x5E000000; // | pattern ID << 8 | chunk. No longer saved.
+
+// Longest to wait for a gap between LED frames before writing to flash anyway, in microseconds.
+// Fast animations may never leave a gap long enough for a sector erase.
+static const int64_t maxFlashWait = 500000;
+
+// Changes are kept in RAM for this long after the first one, so a burst of saves only writes each block once, in ms
+static const uint32_t writeBackDelay = 5000;
 
 DeviceConfig::DeviceConfig(uint32_t storageSize, uint32_t blockSize)
-:   _storage(PICO_FLASH_SIZE_BYTES - storageSize, storageSize, blockSize)
+:   _storage(_flash, PICO_FLASH_SIZE_BYTES - storageSize, storageSize, blockSize),
+    _flashTimer([this]() { return WriteToFlash(); }, 0),
+    _writingFlash(false),
+    _writeBackTimer([this]() { return WriteBack(); }, 0)
+{
+    UpgradeOldPatterns();
+}
+
+void DeviceConfig::SetFlashWindow(std::function<uint32_t()> &&idleTime)
+{
+    _idleTime = std::move(idleTime);
+}
+
+void DeviceConfig::SetFlashExecutor(PicoFlash::FlashExecutor &&executor)
+{
+    _flash.SetExecutor(std::move(executor));
+}
+
+const uint8_t *DeviceConfig::GetBlock(uint32_t blockId, size_t *size)
+{
+    auto cached = _dirtyBlocks.find(blockId);
+    if(cached != _dirtyBlocks.end())
+    {
+        if(cached->second.cleared)
+            return nullptr;
+        if(size)
+            *size = cached->second.data.size();
+        return cached->second.data.data();
+    }
+    return _storage.GetBlock(blockId, size);
+}
+
+std::vector<uint32_t> DeviceConfig::GetBlockIds(uint32_t firstId, uint32_t lastId)
+{
+    std::vector<uint32_t> blockIds;
+    _storage.GetBlockIds(firstId, lastId, blockIds);
+
+    // Cached changes may add blocks, or clear them
+    for(auto cached = _dirtyBlocks.lower_bound(firstId); cached != _dirtyBlocks.end() && cached->first <= lastId; cached++)
+    {
+        auto stored = std::lower_bound(blockIds.begin(), blockIds.end(), cached->first);
+        auto found = stored != blockIds.end() && *stored == cached->first;
+        if(cached->second.cleared && found)
+            blockIds.erase(stored);
+        else if(!cached->second.cleared && !found)
+            blockIds.insert(stored, cached->first);
+    }
+    return blockIds;
+}
+
+bool DeviceConfig::SaveBlock(uint32_t blockId, const uint8_t *data, size_t size)
+{
+    if(size > _storage.BlockSize())
+    {
+        DBG_PRINT("Block %08x is too big to save (%d bytes)\n", blockId, (int)size);
+        return false;
+    }
+
+    // Saves that change nothing are dropped, to avoid flash wear
+    auto cached = _dirtyBlocks.find(blockId);
+    if(cached != _dirtyBlocks.end() && !cached->second.cleared &&
+        cached->second.data.size() == size && !memcmp(cached->second.data.data(), data, size))
+        return false;
+
+    size_t storedSize;
+    auto stored = _storage.GetBlock(blockId, &storedSize);
+    auto matchesStored = stored && storedSize == size && !memcmp(stored, data, size);
+    if(cached == _dirtyBlocks.end())
+    {
+        if(matchesStored)
+            return false;
+        if(_dirtyBlocks.empty())
+            _writeBackTimer.ResetTimer(writeBackDelay);
+        _dirtyBlocks[blockId] = { std::vector<uint8_t>(data, data + size), false };
+    }
+    else if(matchesStored)
+    {
+        // Changed back before it was written
+        _dirtyBlocks.erase(cached);
+    }
+    else
+    {
+        // The data may be the cached block itself, so copy it before replacing it
+        cached->second = { std::vector<uint8_t>(data, data + size), false };
+    }
+    return true;
+}
+
+void DeviceConfig::ClearBlock(uint32_t blockId)
+{
+    if(!_storage.GetBlock(blockId))
+    {
+        _dirtyBlocks.erase(blockId);
+        return;
+    }
+
+    if(_dirtyBlocks.empty())
+        _writeBackTimer.ResetTimer(writeBackDelay);
+    _dirtyBlocks[blockId] = { {}, true };
+}
+
+uint32_t DeviceConfig::WriteBack()
+{
+    if(_dirtyBlocks.empty())
+        return 0;
+
+    DBG_PRINT("Writing back %d changed blocks\n", (int)_dirtyBlocks.size());
+    for(auto &[blockId, block] : _dirtyBlocks)
+    {
+        if(block.cleared)
+            _storage.ClearBlock(blockId);
+        else
+            _storage.SaveBlock(blockId, block.data.data(), block.data.size());
+    }
+    _dirtyBlocks.clear();
+    StartFlashWrites();
+    return 0;
+}
+
+void DeviceConfig::StartFlashWrites()
+{
+    if(!_writingFlash)
+    {
+        _writingFlash = true;
+        _flashWaitStart = get_absolute_time();
+        _flashTimer.ResetTimer(1);
+    }
+}
+
+uint32_t DeviceConfig::WriteToFlash()
+{
+    auto writeTime = _storage.NextWriteTime();
+    if(!writeTime)
+    {
+        _writingFlash = false;
+        return 0;
+    }
+
+    // The writes are done a page at a time, each in the gap after an LED frame has gone out
+    auto idleTime = _idleTime ? _idleTime() : UINT32_MAX;
+    if(idleTime < writeTime && absolute_time_diff_us(_flashWaitStart, get_absolute_time()) < maxFlashWait)
+        return 1;
+
+    _storage.WriteNext();
+    _flashWaitStart = get_absolute_time();
+    return 1;
+}
+
+void DeviceConfig::Flush()
 {
+    _writeBackTimer.ResetTimer(0);
+    WriteBack();
+    _storage.Flush();
 }
 
 const WifiConfig * DeviceConfig::GetWifiConfig()
 {
-    auto creds = (const WifiConfig *)_storage.GetBlock(wifiConfigMagic);
+    auto creds = (const WifiConfig *)GetBlock(wifiConfigMagic);
     return creds;
 }
 
 void DeviceConfig::SaveWifiConfig(const WifiConfig *config)
 {
-    _storage.SaveBlock(wifiConfigMagic, (const uint8_t *)config, sizeof(WifiConfig));
+    SaveBlock(wifiConfigMagic, (const uint8_t *)config, sizeof(WifiConfig));
 }
 
 const MqttConfig *DeviceConfig::GetMqttConfig()
 {
-    auto creds = (const MqttConfig *)_storage.GetBlock(mqttConfigMagic);
+    auto creds = (const MqttConfig *)GetBlock(mqttConfigMagic);
     return creds;
 }
 
 void DeviceConfig::SaveMqttConfig(const MqttConfig *mqttConfig)
 {
-    _storage.SaveBlock(mqttConfigMagic, (const uint8_t *)mqttConfig, sizeof(MqttConfig));
+    SaveBlock(mqttConfigMagic, (const uint8_t *)mqttConfig, sizeof(MqttConfig));
 }
 
 const LightConfig *DeviceConfig::GetLightConfig()
 {
-    auto lightCfg = (const LightConfig *)_storage.GetBlock(lightConfigMagic);
+    auto lightCfg = (const LightConfig *)GetBlock(lightConfigMagic);
     return lightCfg;
 }
 
 void DeviceConfig::SaveLightConfig(const LightConfig *lightConfig)
 {
-    auto existingConfig = GetLightConfig();
-    if(existingConfig != nullptr && !::memcmp(existingConfig, lightConfig, sizeof(LightConfig)))
-    {
-        // Avoid flash wear
+    if(!SaveBlock(lightConfigMagic, (const uint8_t *)lightConfig, sizeof(LightConfig)))
         DBG_PUT("No changes to save");
-        return;
-    }
+}
 
-    _storage.SaveBlock(lightConfigMagic, (const uint8_t *)lightConfig, sizeof(LightConfig));
+const uint16_t *DeviceConfig::GetPatternIds(uint32_t *count)
+{
+    // The pattern IDs are part of the block IDs, so adding or deleting a pattern is a single block write
+    if(_patternIds.empty())
+    {
+        for(auto blockId : GetBlockIds(patternConfigMagic, patternConfigMagic | 0xFFFF))
+            _patternIds.push_back(blockId & 0xFFFF);
+    }
+    *count = _patternIds.size();
+    return _patternIds.data();
 }
 
-void DeviceConfig::SavePatternIds(const uint16_t *blindIds, uint32_t count)
+const PatternConfig *DeviceConfig::GetPatternConfig(uint16_t patternId)
 {
-    SaveIdList(patternsConfigMagic, blindIds, count);
+    size_t size;
+    auto block = GetBlock(patternConfigMagic | patternId, &size);
+    if(!block || !UnpackPattern(block, size, _unpackedPattern))
+        return nullptr;
+    return &_unpackedPattern;
 }
 
-const uint16_t *DeviceConfig::GetPatternIds(uint32_t *count)
+bool DeviceConfig::GetPatternPixels(uint16_t patternId, neopixel *pixels)
 {
-    return GetIdList(patternsConfigMagic, count);
+    size_t size;
+    auto block = GetBlock(patternConfigMagic | patternId, &size);
+    if(!block)
+        return false;
+    if(IsPackedPattern(block, size))
+        return UnpackPatternPixels(block, size, pixels);
+
+    auto pattern = GetPatternConfig(patternId);
+    if(!pattern)
+        return false;
+    std::copy(pattern->pixels, pattern->pixels + PIXEL_COUNT, pixels);
+    return true;
 }
 
-const PatternConfig *DeviceConfig::GetPatternConfig(uint16_t patternId)
+bool DeviceConfig::GetPatternSummary(uint16_t patternId, PatternSummary &summary)
 {
-    return (PatternConfig *)_storage.GetBlock(patternConfigMagic | patternId);
+    size_t size;
+    auto block = GetBlock(patternConfigMagic | patternId, &size);
+    return block && UnpackPatternSummary(block, size, summary);
 }
 
 void DeviceConfig::SavePatternConfig(uint16_t patternId, const PatternConfig *patternConfig)
 {
-    // Don't save if there are no changes, to avoid flash wear
-    auto existingCfg = GetPatternConfig(patternId);
-    if(existingCfg &&
-        *patternConfig == *existingCfg)
+    if(!std::binary_search(_patternIds.begin(), _patternIds.end(), patternId))
+        _patternIds.clear();
+
+    auto packed = PackPattern(*patternConfig);
+    if(!SaveBlock(patternConfigMagic | patternId, packed.data(), packed.size()))
     {
         DBG_PUT("No changes to save");
         return;
     }
-    DBG_PRINT("Saving pattern config for %d\n", patternId);
-    _storage.SaveBlock(patternConfigMagic | patternId, (const uint8_t *)patternConfig, sizeof(*patternConfig));
-    DBG_PUT("Pattern config saved\n");
+    DBG_PRINT("Saved pattern config for %d\n", patternId);
+    _patternChains.clear();
 }
 
-void DeviceConfig::DeletePatternConfig(uint16_t patternId)
+void DeviceConfig::UpgradeOldPatterns()
 {
-    _storage.ClearBlock(patternConfigMagic | patternId);
-}
+    // The list of pattern IDs isn't needed now they're found from the block IDs
+    if(GetBlock(patternsConfigMagic))
+    {
+        DBG_PUT("Removing the old pattern ID list");
+        ClearBlock(patternsConfigMagic);
+    }
 
-void DeviceConfig::HardReset()
-{
-        // The flash storage has no wifi config. Format it to ensure it is empty, and
-        // store default device config
-        _storage.Format();
+    // Packed sequences were stored in chunks under their first pattern, but are only kept in RAM now
+    auto sequenceBlocks = GetBlockIds(sequenceConfigMagic, sequenceConfigMagic | 0xFFFFFF);
+    for(auto blockId : sequenceBlocks)
+        ClearBlock(blockId);
+    if(!sequenceBlocks.empty())
+        DBG_PRINT("Removing %d stored sequence chunks\n", (int)sequenceBlocks.size());
 
-        WifiConfig cfg;
-        memset(&cfg, 0, sizeof(WifiConfig));
-        DBG_PUT("Saving WiFi config\n");
-        SaveWifiConfig(&cfg);
+    uint32_t count;
+    auto ids = GetPatternIds(&count);
+    std::vector<uint16_t> patternIds(ids, ids + count);
 
-        MqttConfig mcfg;
-        memset(&mcfg, 0, sizeof(mcfg));
-        strcpy(mcfg.brokerAddress, "");
-        mcfg.port = 1883;
-        DBG_PUT("Saving Mqtt config\n");
-        SaveMqttConfig(&mcfg);
+    auto packedCount = 0;
+    for(auto patternId : patternIds)
+    {
+        size_t size;
+        auto block = GetBlock(patternConfigMagic | patternId, &size);
+        if(!block || IsPackedPattern(block, size))
+            continue;
 
+        auto pattern = GetPatternConfig(patternId);
+        if(!pattern)
+            continue;
+        auto packed = PackPattern(*pattern);
+        SaveBlock(patternConfigMagic | patternId, packed.data(), packed.size());
+
+        // Write each one straight away, rather than holding them all in RAM
+        Flush();
+        packedCount++;
+    }
+
+    if(packedCount)
+        DBG_PRINT("Packed %d patterns saved by older firmware\n", packedCount);
+}
+
+void DeviceConfig::DeletePatternConfig(uint16_t patternId)
+{
+    _patternChains.clear();
+    _patternIds.clear();
+    ClearBlock(patternConfigMagic | patternId);
 }
 
-void DeviceConfig::SaveIdList(uint32_t header, const uint16_t *ids, uint32_t count)
+const PatternChain *DeviceConfig::GetPatternChain(uint16_t startPatternId)
 {
-    DBG_PRINT("Saving %d IDs to header %08x\n", count, header);
+    auto cached = _patternChains.find(startPatternId);
+    if(cached != _patternChains.end())
+        return &cached->second;
 
-    size_t bytes = sizeof(count) + sizeof(uint16_t) * count;
-    if(bytes > _storage.BlockSize())
-        DBG_PUT("Too many ids to fit in the block. FAIL\n");
+    PatternChain chain;
+    chain.loopFrame = -1;
 
-    auto buf = (uint8_t *)malloc(bytes);
-    if(buf == nullptr)
+    int32_t patternId = startPatternId;
+    while(patternId >= 0 && chain.patternIds.size() < MAX_CHAIN_LENGTH)
     {
-        DBG_PRINT("Failed to allocate a buffer of %d bytes to save ID list\n", bytes);
-        return;
+        auto seen = std::find(chain.patternIds.begin(), chain.patternIds.end(), patternId);
+        if(seen != chain.patternIds.end())
+        {
+            chain.loopFrame = seen - chain.patternIds.begin();
+            break;
+        }
+
+        auto pattern = GetPatternConfig(patternId);
+        if(!pattern)
+            break;
+
+        chain.patternIds.push_back(patternId);
+        patternId = pattern->nextFrameId;
     }
-    memcpy(buf, &count, sizeof(count));
-    memcpy(buf + sizeof(count), ids, sizeof(uint16_t) * count);
-    _storage.SaveBlock(header, buf, bytes);
-    free(buf);
+
+    if(chain.patternIds.empty())
+        return nullptr;
+
+    DBG_PRINT("Resolved pattern chain from %d, %d patterns, loop %d\n", startPatternId, (int)chain.patternIds.size(), chain.loopFrame);
+    return &_patternChains.emplace(startPatternId, std::move(chain)).first->second;
 }
 
-void DeviceConfig::SaveIdList32(uint32_t header, const uint32_t *ids, uint32_t count)
+const EffectConfig *DeviceConfig::GetEffectConfig(uint16_t effectId)
 {
-    size_t bytes = sizeof(count) + sizeof(uint32_t) * count;
-    if(bytes > _storage.BlockSize())
-        DBG_PUT("Too many ids to fit in the block. FAIL\n");
+    if(effectId >= MAX_EFFECTS)
+        return nullptr;
+    return (const EffectConfig *)GetBlock(effectConfigMagic | effectId);
+}
 
-    auto buf = (uint8_t *)malloc(bytes);
-    if(buf == nullptr)
+void DeviceConfig::SaveEffectConfig(uint16_t effectId, const EffectConfig *effectConfig)
+{
+    if(effectId >= MAX_EFFECTS)
+        return;
+
+    if(!SaveBlock(effectConfigMagic | effectId, (const uint8_t *)effectConfig, sizeof(*effectConfig)))
     {
-        DBG_PRINT("Failed to allocate a buffer of %d bytes to save ID list\n", bytes);
+        DBG_PUT("No changes to save");
         return;
     }
-    memcpy(buf, &count, sizeof(count));
-    memcpy(buf + sizeof(count), ids, sizeof(uint32_t) * count);
-    _storage.SaveBlock(header, buf, bytes);
-    free(buf);
+    DBG_PRINT("Saved effect config for %d\n", effectId);
 }
 
-const uint16_t *DeviceConfig::GetIdList(uint32_t header, uint32_t *count)
+void DeviceConfig::DeleteEffectConfig(uint16_t effectId)
 {
-    auto block = (const uint32_t *)_storage.GetBlock(header);
-    if(block == nullptr)
-    {
-        *count = 0;
-        return nullptr;
-    }
-    *count = *block;
-    return (const uint16_t *)(block + 1);
+    ClearBlock(effectConfigMagic | effectId);
 }
 
-const uint32_t *DeviceConfig::GetIdList32(uint32_t header, uint32_t *count)
+void DeviceConfig::HardReset()
 {
-    auto block = (const uint32_t *)_storage.GetBlock(header);
-    if(block == nullptr)
-    {
-        *count = 0;
-        return nullptr;
-    }
-    *count = *block;
-    return (block + 1);
+        // The flash storage has no wifi config. Format it to ensure it is empty, and
+        // store default device config
+        _writeBackTimer.ResetTimer(0);
+        _dirtyBlocks.clear();
+        _storage.Format();
+        _patternChains.clear();
+        _patternIds.clear();
+
+        WifiConfig cfg;
+        memset(&cfg, 0, sizeof(WifiConfig));
+        DBG_PUT("Saving WiFi config\n");
+        SaveWifiConfig(&cfg);
+
+        MqttConfig mcfg;
+        memset(&mcfg, 0, sizeof(mcfg));
+        strcpy(mcfg.brokerAddress, "");
+        mcfg.port = 1883;
+        DBG_PUT("Saving Mqtt config\n");
+        SaveMqttConfig(&mcfg);
+        Flush();
+
 }
 
 bool operator==(const PatternConfig &left, const PatternConfig &right)
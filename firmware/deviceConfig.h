@@ -4,8 +4,14 @@
 #pragma once
 
 #include "blockStorage.h"
+#include "PicoFlash.h"
 #include "NeoPixel.h"
 #include "Miku.h"
+#include "EffectVm.h"
+#include "scheduler.h"
+#include <functional>
+#include <map>
+#include <vector>
 
 #define SAVE_DELAY 120000
 
@@ -33,13 +39,40 @@ struct PatternConfig
     int32_t transitionTime;
 };
 
+// The parts of a pattern needed to list it, without unpacking the pixels
+struct PatternSummary
+{
+    char patternName[48];
+    int32_t nextFrameId;
+};
+
+#define MAX_EFFECTS 16
+#define MAX_CHAIN_LENGTH 256
+
+// A user defined effect, run by the effect VM
+struct EffectConfig
+{
+    char effectName[48];
+    uint16_t frameTime; // Milliseconds between frames
+    uint16_t codeLength;
+    uint8_t code[MaxEffectCodeLength];
+};
+
+/// @brief A chain of patterns linked by nextFrameId, resolved once and kept in RAM
+struct PatternChain
+{
+    std::vector<uint16_t> patternIds;
+    int loopFrame;        // Index of the pattern the last one links back to, or -1 if the chain ends
+};
+
 enum LightState
 {
     Off,
     Miku,
     Colour,
     Pattern,
-    Animation
+    Animation,
+    Effect
 };
 
 struct LightConfig
@@ -50,11 +83,16 @@ struct LightConfig
     float brightness;
     int patternId;
     int animationId;
+    int effectId;
 };
 
 
 bool operator==(const PatternConfig &left, const PatternConfig &right);
 
+/// @brief The device's settings, patterns and effects, kept in flash
+/// @remarks The Get functions return pointers into flash or into saves still waiting to be written, so they're only
+/// valid until the next save, which may move the blocks. Don't hold one across an async callback, such as the parts of
+/// an SSI response or a timer; copy what's needed instead.
 class DeviceConfig
 {
     public:
@@ -69,24 +107,74 @@ class DeviceConfig
         const LightConfig *GetLightConfig();
         void SaveLightConfig(const LightConfig *lightConfig);
 
-        /// @brief Get the IDs of all the registered patterns
-        /// @param count [out] number of patterns registered
+        /// @brief Get the IDs of all the saved patterns, in order
+        /// @param count [out] number of patterns saved
+        /// @return The IDs, only valid until a pattern is added or deleted
         const uint16_t *GetPatternIds(uint32_t *count);
-        void SavePatternIds(const uint16_t *patternIds, uint32_t count);
 
+        /// @brief Get a pattern, unpacked from how it's stored
+        /// @return The pattern, or nullptr if there's no such pattern. It's only valid until the next call.
         const PatternConfig *GetPatternConfig(uint16_t patternId);
+        /// @brief Unpacks just the pixels of a pattern, straight into a frame
+        /// @param pixels PIXEL_COUNT pixels to fill
+        bool GetPatternPixels(uint16_t patternId, neopixel *pixels);
+        /// @brief Gets the name and next frame of a pattern, which is quicker than unpacking all of it
+        bool GetPatternSummary(uint16_t patternId, PatternSummary &summary);
         void SavePatternConfig(uint16_t patternId, const PatternConfig *patternConfig);
         void DeletePatternConfig(uint16_t patternId);
 
+        /// @brief Follows the nextFrameId links from a pattern, stopping at the first loop
+        /// @remarks The chain is cached until a pattern is saved or deleted, so it's only read from flash once
+        /// @return The chain, or nullptr if the starting pattern doesn't exist
+        const PatternChain *GetPatternChain(uint16_t startPatternId);
+
+        /// @brief Get a user defined effect
+        /// @param effectId Slot of the effect, less than MAX_EFFECTS
+        const EffectConfig *GetEffectConfig(uint16_t effectId);
+        void SaveEffectConfig(uint16_t effectId, const EffectConfig *effectConfig);
+        void DeleteEffectConfig(uint16_t effectId);
+
         void HardReset();
 
+        /// @brief Lets flash writes wait for a gap between LED frames, as the animations stop while flash is written
+        /// @param idleTime Returns how many microseconds until the next frame is due, or 0 while one is being drawn
+        void SetFlashWindow(std::function<uint32_t()> &&idleTime);
+
+        /// @brief Runs the flash writes some other way than flash_safe_execute, such as keeping the animations going
+        void SetFlashExecutor(PicoFlash::FlashExecutor &&executor);
+
+        /// @brief Writes any saved changes still waiting to go to flash. Call before rebooting.
+        /// @remarks Saves are kept in RAM for a few seconds first, so repeated saves of the same config only write it once.
+        void Flush();
+
     private:
         DeviceConfig(const DeviceConfig &) = delete;
 
-        void SaveIdList(uint32_t header, const uint16_t *ids, uint32_t count);
-        const uint16_t *GetIdList(uint32_t header, uint32_t *count);
-        void SaveIdList32(uint32_t header, const uint32_t *ids, uint32_t count);
-        const uint32_t *GetIdList32(uint32_t header, uint32_t *count);
+        const uint8_t *GetBlock(uint32_t blockId, size_t *size = nullptr);
+        std::vector<uint32_t> GetBlockIds(uint32_t firstId, uint32_t lastId);
+        bool SaveBlock(uint32_t blockId, const uint8_t *data, size_t size);
+        void ClearBlock(uint32_t blockId);
+        uint32_t WriteBack();
+        void StartFlashWrites();
+        void UpgradeOldPatterns();
+        uint32_t WriteToFlash();
 
+        PicoFlash _flash;
         BlockStorage _storage;
+        std::function<uint32_t()> _idleTime;
+        ScheduledTimer _flashTimer;
+        bool _writingFlash;
+        absolute_time_t _flashWaitStart;
+
+        // Changes not yet handed to the block storage
+        struct DirtyBlock
+        {
+            std::vector<uint8_t> data;
+            bool cleared;
+        };
+        std::map<uint32_t, DirtyBlock> _dirtyBlocks;
+        ScheduledTimer _writeBackTimer;
+        std::map<uint16_t, PatternChain> _patternChains;
+        std::vector<uint16_t> _patternIds;  // Found from the block IDs when needed, empty until then
+        PatternConfig _unpackedPattern;
 };
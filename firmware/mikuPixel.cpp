@@ -18,6 +18,7 @@
 #include "serviceStatus.h"
 #include "serviceControl.h"
 #include "AnimationRunner.h"
+#include "AnimationPool.h"
 #include "animations/PixelMapperAnimation.h"
 #include "animations/WelcomeAnimation.h"
 #include "animations/PingAnimation.h"
@@ -26,22 +27,28 @@
 #include "wifiScanner.h"
 #include "mqttClient.h"
 #include "PatternList.h"
+#include "EffectList.h"
 #include "animations/SolidMikuAnimation.h"
 #include "MikuLight.h"
+#include "AnimationRegistry.h"
 #include "LightController.h"
+#include "AudioInput.h"
 
 
 #define DMA_CHANNEL 0
 #define PIXEL_PIN 2
 
+// Microphone for the audio reactive animations, when built with MIKU_AUDIO_INPUT
+#define AUDIO_PIN 26
+
 // Hard buttons
 #define PIN_RESET 14
 #define PIN_WIFI 15
 
 // How much flash memory to use to store wifi/mqtt config and LED settings. Beware changing these as it will corrupt the block storage
 #define STORAGE_SECTORS 32
-// Max 2 blocks stored in every sector. Aligning these will help with recovering deleted sectors
-#define STORAGE_BLOCK_SIZE 2044
+// Largest block that can be stored: 8 flash pages, less the record header
+#define STORAGE_BLOCK_SIZE 2032
 
 
 void doPollingSleep(uint ms)
@@ -118,7 +125,7 @@ int main()
 
     // Pointless startup cycle, to give me enough time to start putty
 
-    animationRunner->SetAnimation(std::make_unique<WelcomeAnimation>(PIXEL_COUNT));
+    animationRunner->SetAnimation(MakeAnimation<WelcomeAnimation>(PIXEL_COUNT));
     animationRunner->Start();
 
     // Pointless startup cycle, to give me enough time to start putty
@@ -130,6 +137,10 @@ int main()
     const uint32_t StorageSize = STORAGE_SECTORS * FLASH_SECTOR_SIZE;
 
     auto config = std::make_shared<DeviceConfig>(StorageSize, STORAGE_BLOCK_SIZE);
+    config->SetFlashWindow([animationRunner]() { return animationRunner->IdleTime(); });
+    config->SetFlashExecutor([animationRunner](void (*func)(void *), void *param, uint32_t busyTime) {
+        return animationRunner->ExecuteFlash(func, param, busyTime);
+    });
     auto wifiConfig = checkConfig(config);
     if(wifiConfig == nullptr)
     {
@@ -137,9 +148,6 @@ int main()
         return -1;
     }
 
-    // Uncomment to clear all patterns
-    //config->SavePatternIds(nullptr, 0);
-
     auto apMode = !wifiConfig->ssid[0];
 
     auto service = std::make_shared<ServiceControl>();
@@ -159,7 +167,7 @@ int main()
     wifiScanner->WaitForScan();
 
     DBG_PUT("Starting initial animation...");
-    animationRunner->SetAnimation(std::make_unique<PingAnimation>());
+    animationRunner->SetAnimation(MakeAnimation<PingAnimation>());
 
 
     // Now connect to WiFi or Enable AP mode
@@ -180,6 +188,9 @@ int main()
         runServiceMode(webServer, config, wifiConnection, animationRunner, service);
     }
 
+    // Saves are written to flash in the background, so finish them off before rebooting
+    config->Flush();
+
     DBG_PUT("Restarting now!");
     doPollingSleep(1000);
 
@@ -235,7 +246,6 @@ const WifiConfig *checkConfig(
 }
 
 void DoPublish(
-    MikuLight *mikuLight,
     DeviceConfig *config,
     MqttClient *mqttClient)
 {
@@ -267,13 +277,13 @@ void DoPublish(
         "\"hs_cmd_t\": \"~/hs/cmd\", \"hs_stat_t\": \"~/hs/state\", "
         "\"whit_cmd_t\": \"~/wh/cmd\", \"whit_scale\": 255, "
         "\"fx_cmd_t\": \"~/fx/cmd\", \"fx_stat_t\": \"~/fx/state\", \"fx_list\": [");
-    const auto &animationNames = mikuLight->GetAvailableAnimations();
-    for(size_t a = 0; a < animationNames.size(); a++)
+    auto animations = GetAnimations();
+    for(size_t a = 0; a < animations.size(); a++)
     {
         if(a)
             payloadWriter.Append(',');
         payloadWriter.Append("\"");
-        payloadWriter.Append(std::get<0>(animationNames[a]));
+        payloadWriter.Append(animations[a].name);
         payloadWriter.Append("\"");
     }
     payloadWriter.Append(
@@ -323,14 +333,21 @@ void runServiceMode(
     ServiceStatus statusApi(webServer, mqttClient, false);
     DBG_PUT("Starting the Patterns List...");
     PatternList patterns(webServer, config, animationRunner);
+    DBG_PUT("Starting the Effects List...");
+    EffectList effects(webServer, config);
+
+#if MIKU_AUDIO_INPUT
+    DBG_PUT("Starting the audio input...");
+    AudioInput audioInput(AUDIO_PIN);
+#endif
 
     DBG_PUT("Starting the Light Controller...");
     LightController lightController(mikuLight, webServer, mqttClient);
 
-    ScheduledTimer republishTimer([&mikuLight, &config, &mqttClient] () {
+    ScheduledTimer republishTimer([&config, &mqttClient] () {
         // Try to republish discovery information for one device
         // It should be safe to access the collections from this callback.
-        DoPublish(mikuLight.get(), config.get(), mqttClient.get());
+        DoPublish(config.get(), mqttClient.get());
         return 0;
     }, 0);
 
@@ -386,9 +403,8 @@ void runServiceMode(
     animationRunner->Shutdown();
 
 
-    //DBG_PUT("Saving any unsaved state.\n");
-    //remotes->SaveRemoteState();
-    //blinds->SaveBlindState(true);
+    DBG_PUT("Saving any unsaved state.\n");
+    mikuLight->SaveStateNow();
 
 }
 
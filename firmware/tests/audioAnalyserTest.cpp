@@ -0,0 +1,222 @@
+// Feeds WAV recordings through the AudioAnalyser, the way the ADC would.
+//   audioAnalyserTest            - makes a recording of a kick drum between two silences, and checks the beats
+//   audioAnalyserTest file.wav   - prints the levels of each block of a real recording, for tuning
+#include "AudioAnalyser.h"
+#include "testing.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct Recording
+{
+    uint32_t sampleRate = 0;
+    std::vector<int16_t> samples;   // Mono
+};
+
+static void Put16(std::ofstream &file, uint16_t value)
+{
+    file.put(value & 0xFF).put(value >> 8);
+}
+
+static void Put32(std::ofstream &file, uint32_t value)
+{
+    Put16(file, value & 0xFFFF);
+    Put16(file, value >> 16);
+}
+
+static bool WriteWav(const char *path, const Recording &recording)
+{
+    std::ofstream file(path, std::ios::binary);
+    auto dataSize = (uint32_t)recording.samples.size() * 2;
+    file.write("RIFF", 4);
+    Put32(file, 36 + dataSize);
+    file.write("WAVEfmt ", 8);
+    Put32(file, 16);
+    Put16(file, 1);     // PCM
+    Put16(file, 1);     // Mono
+    Put32(file, recording.sampleRate);
+    Put32(file, recording.sampleRate * 2);
+    Put16(file, 2);
+    Put16(file, 16);
+    file.write("data", 4);
+    Put32(file, dataSize);
+    for(auto sample : recording.samples)
+        Put16(file, (uint16_t)sample);
+    return file.good();
+}
+
+// Reads 16 bit PCM, mixing any channels down to mono
+static bool ReadWav(const char *path, Recording &recording)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto get16 = [&data](size_t offset) { return (uint32_t)(data[offset] | (data[offset + 1] << 8)); };
+    auto get32 = [&](size_t offset) { return get16(offset) | (get16(offset + 2) << 16); };
+    if(data.size() < 12 || memcmp(data.data(), "RIFF", 4) || memcmp(data.data() + 8, "WAVE", 4))
+        return false;
+
+    uint32_t channels = 0;
+    for(size_t chunk = 12; chunk + 8 <= data.size(); )
+    {
+        auto size = get32(chunk + 4);
+        auto body = chunk + 8;
+        if(body + size > data.size())
+            size = data.size() - body;
+
+        if(!memcmp(data.data() + chunk, "fmt ", 4) && size >= 16)
+        {
+            if(get16(body) != 1 || get16(body + 14) != 16)
+            {
+                printf("Only 16 bit PCM is supported\n");
+                return false;
+            }
+            channels = get16(body + 2);
+            recording.sampleRate = get32(body + 4);
+        }
+        else if(!memcmp(data.data() + chunk, "data", 4) && channels)
+        {
+            for(size_t frame = body; frame + channels * 2 <= body + size; frame += channels * 2)
+            {
+                int32_t sum = 0;
+                for(uint32_t channel = 0; channel < channels; channel++)
+                    sum += (int16_t)get16(frame + channel * 2);
+                recording.samples.push_back((int16_t)(sum / (int32_t)channels));
+            }
+        }
+        chunk = body + size + (size & 1);
+    }
+    return channels && recording.sampleRate;
+}
+
+// Resamples to the ADC rate, and scales to 12 bit readings around the microphone's mid-rail bias
+static std::vector<uint16_t> ToAdcSamples(const Recording &recording)
+{
+    std::vector<uint16_t> adc;
+    auto step = (double)recording.sampleRate / AudioSampleRate;
+    for(double position = 0; position + 1 < recording.samples.size(); position += step)
+    {
+        auto index = (size_t)position;
+        auto fraction = position - index;
+        auto sample = recording.samples[index] * (1 - fraction) + recording.samples[index + 1] * fraction;
+        adc.push_back((uint16_t)std::clamp(2048 + (int)std::lround(sample / 16), 0, 4095));
+    }
+    return adc;
+}
+
+static std::vector<AudioLevels> Analyse(const std::vector<uint16_t> &adc)
+{
+    AudioAnalyser analyser;
+    std::vector<AudioLevels> blocks;
+    for(size_t start = 0; start + AudioFftSize <= adc.size(); start += AudioFftSize)
+        blocks.push_back(analyser.Process(adc.data() + start));
+    return blocks;
+}
+
+static constexpr uint32_t RecordingRate = 44100;
+static constexpr double SilenceSeconds = 2;
+static constexpr int KickCount = 8;
+static constexpr double KickInterval = 0.5;     // 120 beats a minute
+
+// A 55Hz kick drum every half second over a quiet 1kHz tone, with near silence before and after
+static Recording MakeKickRecording()
+{
+    Recording recording;
+    recording.sampleRate = RecordingRate;
+    auto musicSeconds = KickCount * KickInterval;
+    auto total = (size_t)((SilenceSeconds * 2 + musicSeconds) * RecordingRate);
+    uint32_t noise = 12345;
+    for(size_t i = 0; i < total; i++)
+    {
+        auto t = (double)i / RecordingRate;
+        noise = noise * 1664525 + 1013904223;
+        double sample = (int32_t)(noise >> 16) % 64 - 32;   // Hiss, well under the noise floor
+
+        auto musicTime = t - SilenceSeconds;
+        if(musicTime >= 0 && musicTime < musicSeconds)
+        {
+            auto kickTime = std::fmod(musicTime, KickInterval);
+            sample += 16000 * std::exp(-kickTime / 0.06) * std::sin(2 * M_PI * 55 * kickTime);
+            sample += 1500 * std::sin(2 * M_PI * 1000 * t);
+        }
+        recording.samples.push_back((int16_t)std::clamp(std::lround(sample), -32768l, 32767l));
+    }
+    return recording;
+}
+
+static void PrintLevels(const std::vector<AudioLevels> &blocks)
+{
+    for(auto &levels : blocks)
+    {
+        printf("%5u %6.3fs  bass %3d level %3d  bands", (unsigned)levels.block,
+            (levels.block - 1) * (double)AudioFftSize / AudioSampleRate, levels.bass, levels.level);
+        for(auto band : levels.bands)
+            printf(" %3d", band);
+        printf("%s%s\n", levels.active ? "  active" : "", levels.beat ? "  BEAT" : "");
+    }
+}
+
+static void TestKicks(const char *path)
+{
+    CHECK(WriteWav(path, MakeKickRecording()));
+    Recording recording;
+    CHECK(ReadWav(path, recording));
+    CHECK(recording.sampleRate == RecordingRate);
+
+    auto blocks = Analyse(ToAdcSamples(recording));
+    CHECK(!blocks.empty());
+
+    auto blockSeconds = (double)AudioFftSize / AudioSampleRate;
+    auto musicStart = SilenceSeconds;
+    auto musicEnd = SilenceSeconds + KickCount * KickInterval;
+
+    std::vector<double> beatTimes;
+    for(size_t i = 0; i < blocks.size(); i++)
+    {
+        auto &levels = blocks[i];
+        CHECK(levels.block == i + 1);
+
+        auto start = i * blockSeconds;
+        auto end = start + blockSeconds;
+        if(end <= musicStart - blockSeconds || start >= musicEnd + 0.3)
+            CHECK(!levels.active);
+
+        if(levels.beat)
+            beatTimes.push_back(start);
+    }
+
+    printf("%d beats from %d kicks\n", (int)beatTimes.size(), KickCount);
+    if(beatTimes.size() != KickCount)
+    {
+        PrintLevels(blocks);
+        CHECK(beatTimes.size() == KickCount);
+    }
+
+    // Each kick is one beat, heard within a block or two of it, even though the bass stays up for several blocks
+    for(auto time : beatTimes)
+    {
+        auto sinceKick = std::fmod(time - musicStart + blockSeconds, KickInterval) - blockSeconds;
+        CHECK(time >= musicStart - blockSeconds && time < musicEnd);
+        CHECK(sinceKick < 2 * blockSeconds);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1)
+    {
+        Recording recording;
+        if(!ReadWav(argv[1], recording))
+        {
+            printf("Couldn't read %s\n", argv[1]);
+            return 1;
+        }
+        PrintLevels(Analyse(ToAdcSamples(recording)));
+        return 0;
+    }
+
+    TestKicks("kicks.wav");
+    return TestResult();
+}
@@ -0,0 +1,350 @@
+// Runs BlockStorage on a simulated flash.
+//   - Cuts the power part way through writes, and checks every block reads back as either its old or its new copy.
+//   - Replays a store that's nearly full of patterns while the light state is saved over and over, as MikuLight's
+//     SaveState does, and checks no save is ever lost for want of space, or held up for long behind the compaction.
+//   - Moves blocks from older firmware into the log with the power cut part way through, and checks that once
+//     they've been moved, what's left of a cut erase isn't mistaken for one.
+#include "blockStorage.h"
+#include "RamFlash.h"
+#include "testing.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+// The same layout as the device: 32 sectors at the end of the flash, with blocks of up to 8 pages
+static constexpr uint32_t FlashSize = 2 * 1024 * 1024;
+static constexpr uint32_t StorageSize = 32 * IFlash::SectorSize;
+static constexpr uint32_t StorageBase = FlashSize - StorageSize;
+static constexpr uint32_t StoragePages = StorageSize / IFlash::PageSize;
+static constexpr size_t BlockSize = 2032;
+
+static constexpr uint32_t LightStateId = 0x19841977;
+static constexpr size_t LightStateSize = 28;
+static constexpr uint32_t FirstPatternId = 0xBEEF0000;
+
+using Blocks = std::map<uint32_t, std::vector<uint8_t>>;
+
+static std::vector<uint8_t> RandomData(std::mt19937 &rng, size_t size)
+{
+    std::vector<uint8_t> data(size);
+    for(auto &byte : data)
+        byte = (uint8_t)rng();
+    return data;
+}
+
+// Pages a block takes, with its record header
+static uint32_t BlockPages(size_t size)
+{
+    return (16 + size + IFlash::PageSize - 1) / IFlash::PageSize;
+}
+
+static bool Matches(const BlockStorage &storage, uint32_t blockId, const Blocks &blocks)
+{
+    size_t size;
+    auto stored = storage.GetBlock(blockId, &size);
+    auto block = blocks.find(blockId);
+    if(block == blocks.end())
+        return stored == nullptr;
+    return stored && size == block->second.size() && !memcmp(stored, block->second.data(), size);
+}
+
+static int CountMismatches(const BlockStorage &storage, const Blocks &blocks)
+{
+    auto mismatches = 0;
+    for(auto &[blockId, data] : blocks)
+    {
+        if(!Matches(storage, blockId, blocks))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+static void PrintWear(const char *name, const RamFlash &flash)
+{
+    auto &counts = flash.EraseCounts();
+    auto first = counts.begin() + StorageBase / IFlash::SectorSize;
+    auto [least, most] = std::minmax_element(first, counts.end());
+    printf("%s: sectors erased %u to %u times, %llu pages programmed\n",
+        name, *least, *most, (unsigned long long)flash.ProgramCount());
+}
+
+// Older firmware kept each block in a fixed 8 page slot, with only its ID in front of it
+static void WriteLegacySlot(RamFlash &flash, uint32_t offset, uint32_t blockId, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> slot(8 * IFlash::PageSize, 0xFF);
+    memcpy(slot.data(), &blockId, sizeof(blockId));
+    memcpy(slot.data() + sizeof(blockId), data.data(), data.size());
+    flash.Program(offset, slot.data(), slot.size());
+}
+
+static void TestLegacyMigration(uint32_t seed)
+{
+    static constexpr uint32_t LegacySectors = 24;
+    static constexpr uint32_t SlotSize = 8 * IFlash::PageSize;
+    std::mt19937 rng(seed);
+    RamFlash legacyFlash(FlashSize);
+    Blocks blocks;
+
+    // The first slot of a sector is always taken before the second. Cleared blocks had their ID zeroed.
+    uint32_t nextId = FirstPatternId;
+    for(uint32_t sector = 0; sector < LegacySectors; sector++)
+    {
+        uint32_t slots = rng() % 4 ? 2 : 1;
+        for(uint32_t slot = 0; slot < slots; slot++)
+        {
+            auto data = RandomData(rng, BlockSize);
+            auto blockId = rng() % 5 ? nextId++ : 0;
+            WriteLegacySlot(legacyFlash, StorageBase + sector * IFlash::SectorSize + slot * SlotSize, blockId, data);
+            if(blockId)
+                blocks[blockId] = std::move(data);
+        }
+    }
+
+    // Cut the power at every point of the move, and again at some point on the next start
+    auto cuts = 0;
+    for(uint32_t writes = 0; ; writes += 1 + rng() % 3)
+    {
+        auto flash = legacyFlash;
+        flash.CutPowerAfter(writes, rng() % IFlash::SectorSize);
+        BlockStorage firstStart(flash, StorageBase, StorageSize, BlockSize);
+        if(!flash.IsPowerOff())
+            break;
+
+        cuts++;
+        flash.PowerOn();
+        flash.CutPowerAfter(rng() % 200, rng() % IFlash::SectorSize);
+        BlockStorage secondStart(flash, StorageBase, StorageSize, BlockSize);
+        flash.PowerOn();
+
+        BlockStorage storage(flash, StorageBase, StorageSize, BlockSize);
+        storage.Flush();
+        auto mismatches = CountMismatches(storage, blocks);
+        if(mismatches)
+        {
+            printf("Seed %u: %d blocks from older firmware lost with the power cut after %u writes\n", seed, mismatches, writes);
+            CHECK(false);
+            return;
+        }
+        CHECK(flash.SetByteCount() == 0);
+    }
+    CHECK(cuts > 0);
+
+    BlockStorage storage(legacyFlash, StorageBase, StorageSize, BlockSize);
+    storage.Flush();
+    CHECK(CountMismatches(storage, blocks) == 0);
+
+    // All that's left of an erase cut short looks just like an old slot. It mustn't bring back a deleted block.
+    auto deletedId = blocks.begin()->first;
+    storage.ClearBlock(deletedId);
+    storage.Flush();
+    auto deleted = std::move(blocks.begin()->second);
+    blocks.erase(deletedId);
+
+    auto ghosts = 0;
+    for(uint32_t offset = StorageBase; offset < FlashSize; offset += IFlash::SectorSize)
+    {
+        if(std::all_of(legacyFlash.Map(offset), legacyFlash.Map(offset + IFlash::SectorSize), [](uint8_t byte) { return byte == 0xFF; }))
+        {
+            WriteLegacySlot(legacyFlash, offset, deletedId, deleted);
+            ghosts++;
+        }
+    }
+    CHECK(ghosts > 0);
+
+    BlockStorage rebooted(legacyFlash, StorageBase, StorageSize, BlockSize);
+    CHECK(rebooted.GetBlock(deletedId) == nullptr);
+    CHECK(CountMismatches(rebooted, blocks) == 0);
+
+    // The ghosts are erased, and the storage carries on as normal
+    rebooted.Flush();
+    auto data = RandomData(rng, 100);
+    rebooted.SaveBlock(deletedId, data.data(), data.size());
+    rebooted.Flush();
+    blocks[deletedId] = data;
+    CHECK(CountMismatches(BlockStorage(legacyFlash, StorageBase, StorageSize, BlockSize), blocks) == 0);
+    CHECK(legacyFlash.SetByteCount() == 0);
+
+    printf("Seed %u: %d blocks from older firmware moved, through %d power cuts\n", seed, (int)blocks.size(), cuts);
+}
+
+static void TestPowerCuts(uint32_t seed)
+{
+    static constexpr uint32_t BlockCount = 30;
+    std::mt19937 rng(seed);
+    RamFlash flash(FlashSize);
+    auto storage = std::make_unique<BlockStorage>(flash, StorageBase, StorageSize, BlockSize);
+    Blocks blocks;
+
+    auto cuts = 0;
+    for(auto step = 0; step < 4000; step++)
+    {
+        auto blockId = 1 + rng() % BlockCount;
+        auto save = rng() % 10 < 8;
+        auto data = RandomData(rng, rng() % 4 == 0 ? BlockSize : rng() % 600);
+        if(rng() % 5 == 0)
+            flash.CutPowerAfter(rng() % 12, rng() % IFlash::SectorSize);
+
+        if(save)
+            storage->SaveBlock(blockId, data.data(), data.size());
+        else
+            storage->ClearBlock(blockId);
+        storage->Flush();
+
+        auto saved = blocks;
+        if(save)
+            saved[blockId] = data;
+        else
+            saved.erase(blockId);
+
+        if(!flash.IsPowerOff())
+        {
+            flash.CutPowerAfter(0, 0);
+            blocks = std::move(saved);
+            continue;
+        }
+
+        // Reboot, and find out which copy of the block survived. Every other block must be untouched.
+        cuts++;
+        flash.PowerOn();
+        storage = std::make_unique<BlockStorage>(flash, StorageBase, StorageSize, BlockSize);
+        if(Matches(*storage, blockId, saved))
+            blocks = std::move(saved);
+        else if(!Matches(*storage, blockId, blocks))
+        {
+            printf("Seed %u step %d: block %08x is neither the old nor the new copy\n", seed, step, (unsigned)blockId);
+            CHECK(false);
+            return;
+        }
+
+        auto mismatches = CountMismatches(*storage, blocks);
+        if(mismatches)
+        {
+            printf("Seed %u step %d: %d other blocks damaged by the power cut\n", seed, step, mismatches);
+            CHECK(false);
+            return;
+        }
+    }
+
+    CHECK(cuts > 0);
+    CHECK(CountMismatches(*storage, blocks) == 0);
+    CHECK(flash.SetByteCount() == 0);
+    printf("Seed %u: %d power cuts survived\n", seed, cuts);
+}
+
+static void TestNearlyFull(uint32_t seed, double liveFraction)
+{
+    std::mt19937 rng(seed);
+    RamFlash flash(FlashSize);
+    BlockStorage storage(flash, StorageBase, StorageSize, BlockSize);
+    Blocks blocks;
+
+    // Patterns are either a few colours, or a full frame of pixels that only just fits in a block
+    auto patternSize = [&rng]() { return rng() % 2 ? (size_t)(rng() % 200) : BlockSize - rng() % 232; };
+
+    auto save = [&](uint32_t blockId, std::vector<uint8_t> &&data) {
+        storage.SaveBlock(blockId, data.data(), data.size());
+        blocks[blockId] = std::move(data);
+        return Matches(storage, blockId, blocks);
+    };
+
+    // The flash is written a little at a time between saves, as it is between LED frames
+    auto writeSome = [&]() {
+        if(rng() % 4 == 0)
+            storage.Flush();
+        else
+        {
+            for(auto i = rng() % 20; i > 0; i--)
+                storage.WriteNext();
+        }
+    };
+
+    uint32_t livePages = BlockPages(LightStateSize);
+    uint32_t patternCount = 0;
+    while(livePages < liveFraction * StoragePages)
+    {
+        auto data = RandomData(rng, patternSize());
+        livePages += BlockPages(data.size());
+        save(FirstPatternId + patternCount++, std::move(data));
+        writeSome();
+    }
+
+    // How long each light state save takes to reach the flash, counting the writes queued ahead of it, in microseconds
+    auto writeOut = [&]() {
+        uint32_t time = 0;
+        while(auto next = storage.NextWriteTime())
+        {
+            time += next;
+            if(!storage.WriteNext())
+                break;
+        }
+        return time;
+    };
+    uint32_t worstSaveTime = 0;
+    uint64_t totalSaveTime = 0;
+
+    auto failedSaves = 0;
+    for(auto step = 0; step < 20000; step++)
+    {
+        if(!save(LightStateId, RandomData(rng, LightStateSize)))
+            failedSaves++;
+        auto saveTime = writeOut();
+        worstSaveTime = std::max(worstSaveTime, saveTime);
+        totalSaveTime += saveTime;
+
+        // Now and then a pattern is edited, which may change its size
+        if(rng() % 4 == 0)
+        {
+            auto blockId = FirstPatternId + rng() % patternCount;
+            auto before = blocks[blockId].size();
+            auto data = RandomData(rng, patternSize());
+            auto after = data.size();
+
+            // Only while the patterns would still leave the same space free, so the store never really fills up
+            if(livePages - BlockPages(before) + BlockPages(after) <= liveFraction * StoragePages + BlockPages(BlockSize))
+            {
+                livePages += BlockPages(after) - BlockPages(before);
+                if(!save(blockId, std::move(data)))
+                    failedSaves++;
+            }
+        }
+        writeSome();
+    }
+
+    storage.Flush();
+    CHECK(failedSaves == 0);
+    CHECK(CountMismatches(storage, blocks) == 0);
+    CHECK(flash.SetByteCount() == 0);
+
+    BlockStorage rebooted(flash, StorageBase, StorageSize, BlockSize);
+    CHECK(CountMismatches(rebooted, blocks) == 0);
+
+    // Saves that run short of space reclaim whole sectors before they go in, each taking at worst a program, a commit
+    // and an invalidation for every page, and the erase. None should need more than a quarter of the store.
+    constexpr uint32_t PagesPerSector = IFlash::SectorSize / IFlash::PageSize;
+    constexpr uint32_t SectorReclaimTime = IFlash::SectorEraseTime + 3 * PagesPerSector * IFlash::PageProgramTime;
+    CHECK(worstSaveTime <= StorageSize / IFlash::SectorSize / 4 * SectorReclaimTime);
+
+    printf("%.0f%% live: %d failed saves, light state written in %.1f ms on average, %.1f ms at worst. ",
+        liveFraction * 100, failedSaves, totalSaveTime / 20000 / 1000.0, worstSaveTime / 1000.0);
+    PrintWear("Wear", flash);
+}
+
+int main()
+{
+    for(uint32_t seed = 1; seed <= 4; seed++)
+        TestPowerCuts(seed);
+
+    for(uint32_t seed = 1; seed <= 2; seed++)
+        TestLegacyMigration(seed);
+
+    for(uint32_t seed = 1; seed <= 3; seed++)
+    {
+        TestNearlyFull(seed, 0.72);
+        TestNearlyFull(seed, 0.85);
+    }
+
+    return TestResult();
+}
@@ -0,0 +1,119 @@
+// Checks the effect VM's cost limit, and times the most expensive programs it lets through.
+// The times are for the host, so they only compare programs with each other. What matters on the
+// device is the cost model in EffectVm.h, which these programs are built to hit.
+#include "EffectVm.h"
+#include "testing.h"
+#include <chrono>
+#include <vector>
+
+using enum EffectOp;
+
+// PIXEL_COUNT, which comes with the Pico SDK headers
+static constexpr int PixelCount = 329;
+static constexpr int BenchmarkFrames = 200;
+
+// Builds a program that pushes a value, runs the body over and over, then pushes two more for the colour
+static std::vector<uint8_t> BuildProgram(const std::vector<uint8_t> &body, int repeats)
+{
+    std::vector<uint8_t> code = { (uint8_t)Index };
+    for(auto i = 0; i < repeats; i++)
+        code.insert(code.end(), body.begin(), body.end());
+    code.insert(code.end(), { (uint8_t)PosX, (uint8_t)PosY, (uint8_t)End });
+    return code;
+}
+
+// The most repeats of the body that still pass validation
+static int MostRepeats(const std::vector<uint8_t> &body)
+{
+    auto repeats = 0;
+    while(true)
+    {
+        auto code = BuildProgram(body, repeats + 1);
+        if(code.size() > MaxEffectCodeLength || !ValidateEffect(code.data(), code.size()))
+            return repeats;
+        repeats++;
+    }
+}
+
+struct Workload
+{
+    const char *name;
+    std::vector<uint8_t> body;
+};
+
+static void TestCostLimit()
+{
+    // The longest program of the cheapest instructions is far over the budget
+    std::vector<uint8_t> longest = { (uint8_t)Index, (uint8_t)PosX, (uint8_t)PosY };
+    while(longest.size() < MaxEffectCodeLength - 1)
+        longest.insert(longest.end(), { (uint8_t)Dup, (uint8_t)Drop });
+    longest.push_back((uint8_t)End);
+    CHECK(EffectCost(longest.data(), longest.size()) > MaxEffectCost);
+    CHECK(!ValidateEffect(longest.data(), longest.size()));
+
+    // A typical rainbow fits easily
+    const std::vector<uint8_t> rainbow = {
+        (uint8_t)PosX, (uint8_t)Time, (uint8_t)Add, (uint8_t)Push16, 0xFF, 0x00, (uint8_t)And,
+        (uint8_t)Push16, 0xFF, 0x00, (uint8_t)Push16, 0xFF, 0x00, (uint8_t)Hsv, (uint8_t)End };
+    CHECK(ValidateEffect(rainbow.data(), rainbow.size()));
+    CHECK(EffectCost(rainbow.data(), rainbow.size()) < MaxEffectCost / 10);
+
+    // Only the more expensive side of a branch counts
+    const std::vector<uint8_t> branch = {
+        (uint8_t)Index, (uint8_t)Dup, (uint8_t)Dup, (uint8_t)Index, (uint8_t)Jz, 1,
+        (uint8_t)Hsv, (uint8_t)End };
+    auto branchCost = EffectCost(branch.data(), branch.size());
+    CHECK(branchCost == 16 * 4 + 22 + 100 + 14);
+}
+
+static void Benchmark(const Workload &workload)
+{
+    auto repeats = MostRepeats(workload.body);
+    auto code = BuildProgram(workload.body, repeats);
+    auto cost = EffectCost(code.data(), code.size());
+    CHECK(repeats > 0);
+    CHECK(cost <= MaxEffectCost);
+
+    // One more repeat is over the limit, unless the program would be too long anyway
+    auto over = BuildProgram(workload.body, repeats + 1);
+    CHECK(over.size() > MaxEffectCodeLength || EffectCost(over.data(), over.size()) > MaxEffectCost);
+
+    EffectInputs inputs = {};
+    uint32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(auto frame = 0; frame < BenchmarkFrames; frame++)
+    {
+        inputs.time = frame;
+        for(auto pixel = 0; pixel < PixelCount; pixel++)
+        {
+            inputs.index = pixel;
+            inputs.x = pixel % 127;
+            inputs.y = pixel / 3;
+            checksum += RunEffect(code.data(), code.size(), inputs).colour;
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-10s %3d bytes, %4u cycles a pixel, %6.1f ms a frame on the device, %7.1f us a frame here (%08x)\n",
+        workload.name, (int)code.size(), (unsigned)cost,
+        (cost + EffectPixelCost) * PixelCount / (EffectFrameBudget / 8.0),
+        elapsed / BenchmarkFrames, (unsigned)checksum);
+}
+
+int main()
+{
+    TestCostLimit();
+
+    const Workload workloads[] = {
+        { "stack", { (uint8_t)Dup, (uint8_t)Drop } },
+        { "arith", { (uint8_t)Push8, 3, (uint8_t)Mul, (uint8_t)Push8, 5, (uint8_t)Add } },
+        { "divide", { (uint8_t)Push8, 7, (uint8_t)Div, (uint8_t)Push8, 9, (uint8_t)Mod } },
+        { "sine", { (uint8_t)Sin } },
+        { "hsv", { (uint8_t)Dup, (uint8_t)Dup, (uint8_t)Hsv, (uint8_t)Drop, (uint8_t)Drop } },
+        { "branch", { (uint8_t)Dup, (uint8_t)Jz, 1, (uint8_t)Neg } },
+    };
+    for(auto &workload : workloads)
+        Benchmark(workload);
+
+    return TestResult();
+}
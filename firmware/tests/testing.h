@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdio>
+
+// Just enough for the host tests. A failed check is reported and the test carries on, failing when main returns.
+
+inline int &TestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) \
+        { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            TestFailures()++; \
+        } \
+    } while(0)
+
+inline int TestResult()
+{
+    if(TestFailures())
+        printf("%d checks failed\n", TestFailures());
+    else
+        printf("Passed\n");
+    return TestFailures() ? 1 : 0;
+}
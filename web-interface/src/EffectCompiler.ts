@@ -0,0 +1,227 @@
+// Assembler for the firmware effect VM (firmware/EffectVm.h).
+// A program runs once per pixel and leaves red, green and blue on the stack, e.g.
+//
+//     x time add 255 and    ; hue
+//     255 255 hsv
+//
+// Numbers are pushed, "name:" defines a label, and "jz name" / "jmp name" jump forwards to a label.
+// Comments start with ';' or '#'.
+
+export const MAX_EFFECT_CODE_LENGTH = 256;
+const MAX_STACK_DEPTH = 16;
+// Estimated cycles per pixel for the most expensive path through a program, as the firmware allows
+export const MAX_EFFECT_COST = 2800;
+
+const Push8 = 0x01;
+const Push16 = 0x02;
+const Jz = 0x60;
+const Jmp = 0x61;
+const End = 0x00;
+
+interface OpInfo {
+    code: number;
+    pops: number;
+    pushes: number;
+    cost: number;   // Estimated cycles, matching the firmware's table
+}
+
+const ops: Record<string, OpInfo> = {
+    end: { code: End, pops: 0, pushes: 0, cost: 14 },
+    index: { code: 0x10, pops: 0, pushes: 1, cost: 16 },
+    x: { code: 0x11, pops: 0, pushes: 1, cost: 16 },
+    y: { code: 0x12, pops: 0, pushes: 1, cost: 16 },
+    segment: { code: 0x13, pops: 0, pushes: 1, cost: 16 },
+    time: { code: 0x14, pops: 0, pushes: 1, cost: 16 },
+    dup: { code: 0x20, pops: 1, pushes: 2, cost: 16 },
+    drop: { code: 0x21, pops: 1, pushes: 0, cost: 14 },
+    swap: { code: 0x22, pops: 2, pushes: 2, cost: 18 },
+    over: { code: 0x23, pops: 2, pushes: 3, cost: 16 },
+    add: { code: 0x30, pops: 2, pushes: 1, cost: 19 },
+    sub: { code: 0x31, pops: 2, pushes: 1, cost: 19 },
+    mul: { code: 0x32, pops: 2, pushes: 1, cost: 19 },
+    div: { code: 0x33, pops: 2, pushes: 1, cost: 50 },
+    mod: { code: 0x34, pops: 2, pushes: 1, cost: 50 },
+    neg: { code: 0x35, pops: 1, pushes: 1, cost: 16 },
+    min: { code: 0x36, pops: 2, pushes: 1, cost: 21 },
+    max: { code: 0x37, pops: 2, pushes: 1, cost: 21 },
+    and: { code: 0x38, pops: 2, pushes: 1, cost: 19 },
+    or: { code: 0x39, pops: 2, pushes: 1, cost: 19 },
+    xor: { code: 0x3A, pops: 2, pushes: 1, cost: 19 },
+    shl: { code: 0x3B, pops: 2, pushes: 1, cost: 19 },
+    shr: { code: 0x3C, pops: 2, pushes: 1, cost: 19 },
+    lt: { code: 0x3D, pops: 2, pushes: 1, cost: 21 },
+    gt: { code: 0x3E, pops: 2, pushes: 1, cost: 21 },
+    eq: { code: 0x3F, pops: 2, pushes: 1, cost: 21 },
+    not: { code: 0x40, pops: 1, pushes: 1, cost: 18 },
+    sin: { code: 0x50, pops: 1, pushes: 1, cost: 18 },
+    hsv: { code: 0x51, pops: 3, pushes: 3, cost: 100 },
+};
+
+const opsByCode = new Map<number, OpInfo & { operandBytes: number }>([
+    ...Object.values(ops).map(op => [op.code, { ...op, operandBytes: 0 }] as const),
+    [Push8, { code: Push8, pops: 0, pushes: 1, cost: 18, operandBytes: 1 }],
+    [Push16, { code: Push16, pops: 0, pushes: 1, cost: 22, operandBytes: 2 }],
+    [Jz, { code: Jz, pops: 1, pushes: 0, cost: 22, operandBytes: 1 }],
+    [Jmp, { code: Jmp, pops: 0, pushes: 0, cost: 18, operandBytes: 1 }],
+]);
+
+export class EffectCompileError extends Error {
+    constructor(message: string, public line: number) {
+        super(`Line ${line}: ${message}`);
+    }
+}
+
+/// Assembles effect source into bytecode
+export function compileEffect(source: string): Uint8Array {
+    const code: number[] = [];
+    const labels = new Map<string, number>();
+    const fixups: { label: string, at: number, line: number }[] = [];
+
+    source.split("\n").forEach((text, lineIndex) => {
+        const line = lineIndex + 1;
+        const tokens = text.replace(/[;#].*$/, "").trim().split(/\s+/).filter(t => t.length > 0);
+        for (let i = 0; i < tokens.length; i++) {
+            const token = tokens[i].toLowerCase();
+            if (token.endsWith(":")) {
+                const label = token.slice(0, -1);
+                if (labels.has(label))
+                    throw new EffectCompileError(`Label ${label} is defined twice`, line);
+                labels.set(label, code.length);
+            }
+            else if (/^-?\d+$/.test(token)) {
+                const value = parseInt(token, 10);
+                if (value >= -128 && value <= 127)
+                    code.push(Push8, value & 0xFF);
+                else if (value >= -32768 && value <= 32767)
+                    code.push(Push16, value & 0xFF, (value >> 8) & 0xFF);
+                else
+                    throw new EffectCompileError(`${token} is too big, numbers must fit in 16 bits`, line);
+            }
+            else if (token === "jz" || token === "jmp") {
+                const label = tokens[++i]?.toLowerCase();
+                if (!label)
+                    throw new EffectCompileError(`${token} needs a label`, line);
+                code.push(token === "jz" ? Jz : Jmp, 0);
+                fixups.push({ label, at: code.length - 1, line });
+            }
+            else if (ops[token]) {
+                code.push(ops[token].code);
+            }
+            else {
+                throw new EffectCompileError(`Unknown instruction ${token}`, line);
+            }
+        }
+    });
+
+    for (const fixup of fixups) {
+        const target = labels.get(fixup.label);
+        if (target === undefined)
+            throw new EffectCompileError(`Unknown label ${fixup.label}`, fixup.line);
+        const offset = target - (fixup.at + 1);
+        if (offset < 0)
+            throw new EffectCompileError(`Jumps can only go forwards, to stop effects running forever`, fixup.line);
+        if (offset > 255)
+            throw new EffectCompileError(`Jump to ${fixup.label} is too far`, fixup.line);
+        code[fixup.at] = offset;
+    }
+
+    const bytes = Uint8Array.from(code);
+    const error = validateEffect(bytes);
+    if (error)
+        throw new EffectCompileError(error, 0);
+    return bytes;
+}
+
+/// Checks a program the same way the firmware does before saving it
+/// Returns a description of the problem, or null if the program is fine
+export function validateEffect(code: Uint8Array): string | null {
+    if (code.length === 0)
+        return "The effect is empty";
+    if (code.length > MAX_EFFECT_CODE_LENGTH)
+        return `The effect is ${code.length} bytes, the limit is ${MAX_EFFECT_CODE_LENGTH}`;
+
+    // Stack depth on entry to each instruction. Jumps only go forwards, so one pass sees every way in.
+    const depths = new Array<number>(code.length + 1).fill(-1);
+    const isInstruction = new Array<boolean>(code.length + 1).fill(false);
+    depths[0] = 0;
+    // Most expensive way into each instruction, and out of the program
+    const costs = new Array<number>(code.length + 1).fill(0);
+    let worstCost = 0;
+    const reach = (target: number, cost: number) => {
+        costs[target] = Math.max(costs[target], cost);
+    };
+    const merge = (target: number, depth: number) => {
+        if (depths[target] >= 0 && depths[target] !== depth)
+            return false;
+        depths[target] = depth;
+        return true;
+    };
+
+    const jumps: number[] = [];
+    for (let pc = 0; pc < code.length;) {
+        isInstruction[pc] = true;
+        const info = opsByCode.get(code[pc]);
+        if (!info)
+            return `Unknown opcode ${code[pc]} at ${pc}`;
+        const next = pc + 1 + info.operandBytes;
+        if (next > code.length)
+            return `Instruction at ${pc} is cut short`;
+
+        const depth = depths[pc];
+        if (depth >= 0) {
+            if (depth < info.pops)
+                return `Stack underflow at ${pc}`;
+            const after = depth - info.pops + info.pushes;
+            if (after > MAX_STACK_DEPTH)
+                return `Stack overflow at ${pc}`;
+            const costAfter = costs[pc] + info.cost;
+            if (info.code === End) {
+                if (depth < 3)
+                    return `Effect ends at ${pc} without a colour on the stack`;
+                worstCost = Math.max(worstCost, costAfter);
+            }
+            else {
+                if (info.code === Jz || info.code === Jmp) {
+                    const target = next + code[pc + 1];
+                    if (target > code.length || !merge(target, after))
+                        return `The stack doesn't match at the target of the jump at ${pc}`;
+                    reach(target, costAfter);
+                }
+                if (info.code !== Jmp) {
+                    if (!merge(next, after))
+                        return `The stack doesn't match after ${pc}`;
+                    reach(next, costAfter);
+                }
+            }
+        }
+        if (info.code === Jz || info.code === Jmp)
+            jumps.push(pc);
+        pc = next;
+    }
+
+    if (depths[code.length] >= 0 && depths[code.length] < 3)
+        return "The effect ends without a colour on the stack";
+    if (depths[code.length] >= 0)
+        worstCost = Math.max(worstCost, costs[code.length] + opsByCode.get(End)!.cost);
+
+    isInstruction[code.length] = true;
+    for (const pc of jumps) {
+        const target = pc + 2 + code[pc + 1];
+        if (target > code.length || !isInstruction[target])
+            return `The jump at ${pc} lands inside an instruction`;
+    }
+    if (worstCost > MAX_EFFECT_COST)
+        return `The effect is too slow, taking ${worstCost} cycles a pixel where the limit is ${MAX_EFFECT_COST}`;
+    return null;
+}
+
+export function effectToHex(code: Uint8Array): string {
+    return Array.from(code, b => b.toString(16).padStart(2, "0")).join("");
+}
+
+export function effectFromHex(hex: string): Uint8Array {
+    const bytes = new Uint8Array(hex.length / 2);
+    for (let i = 0; i < bytes.length; i++)
+        bytes[i] = parseInt(hex.substr(i * 2, 2), 16);
+    return bytes;
+}
@@ -11,6 +11,27 @@ export interface AnimationListEntry {
     name: string;
 }
 
+export interface AnimationParameter {
+    id: number;
+    name: string;
+    type: "int" | "bool";
+    min: number;
+    max: number;
+    value: number;
+}
+
+export interface EffectListEntry {
+    id: number;
+    name: string;
+    frameTime: number;
+}
+
+export interface EffectConfig {
+    name: string;
+    frameTime: number;
+    code: string; // Bytecode as hex
+}
+
 export interface RgbPixel{
     r: number;
     g: number;
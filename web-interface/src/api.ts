@@ -1,4 +1,4 @@
-import { PatternListEntry, PatternConfig, AnimationListEntry } from './Pattern';
+import { PatternListEntry, PatternConfig, AnimationListEntry, AnimationParameter, EffectListEntry, EffectConfig } from './Pattern';
 
 export async function getPatternList(): Promise<PatternListEntry[]> {
     const response = await fetch("/api/patterns/list.json");
@@ -59,6 +59,22 @@ export async function getAnimationList(): Promise<AnimationListEntry[]> {
     return await response.json();
 }
 
+export async function getAnimationParameters(): Promise<AnimationParameter[]> {
+    const response = await fetch("/api/animations/parameters.json");
+    if (!response.ok) {
+        throw new Error("Failed to load animation parameters");
+    }
+    return await response.json();
+}
+
+export async function setAnimationParameter(id: number, value: number): Promise<boolean> {
+    const response = await fetch(`/api/animations/setParameter.json?id=${id}&value=${value}`);
+    if (!response.ok) {
+        throw new Error("Failed to set animation parameter");
+    }
+    return await response.json();
+}
+
 export async function activateAnimation(id: number): Promise<boolean> {
     const response = await fetch(`/api/activateAnimation.json?id=${id}`);
     if (!response.ok) {
@@ -67,6 +83,61 @@ export async function activateAnimation(id: number): Promise<boolean> {
     return await response.json();
 }
 
+export async function activateZoneAnimation(zone: number, id: number): Promise<boolean> {
+    const response = await fetch(`/api/activateZoneAnimation.json?zone=${zone}&id=${id}`);
+    if (!response.ok) {
+        throw new Error("Failed to activate zone animation");
+    }
+    return await response.json();
+}
+
+export async function getEffectList(): Promise<EffectListEntry[]> {
+    const response = await fetch("/api/effects/list.json");
+    if (!response.ok) {
+        throw new Error("Failed to load effect list");
+    }
+    return await response.json();
+}
+
+export async function getEffect(id: number): Promise<EffectConfig> {
+    const response = await fetch(`/api/effects/get.json?id=${id}`);
+    if (!response.ok) {
+        throw new Error("Failed to load effect");
+    }
+    return await response.json();
+}
+
+// Saves the effect, returning its ID, or -1 if the firmware rejected it. Leave the ID out to add a new effect.
+export async function saveEffect(id: number | null, name: string, frameTime: number, code: string): Promise<number> {
+    const params = new URLSearchParams({
+        id: id !== null ? id.toString() : "",
+        name,
+        frameTime: frameTime.toString(),
+        code
+    });
+    const response = await fetch(`/api/effects/save.json?${params.toString()}`);
+    if (!response.ok) {
+        throw new Error("Failed to save effect");
+    }
+    return await response.json();
+}
+
+export async function deleteEffect(id: number): Promise<boolean> {
+    const response = await fetch(`/api/effects/delete.json?id=${id}`);
+    if (!response.ok) {
+        throw new Error("Failed to delete effect");
+    }
+    return await response.json();
+}
+
+export async function activateEffect(id: number): Promise<boolean> {
+    const response = await fetch(`/api/activateEffect.json?id=${id}`);
+    if (!response.ok) {
+        throw new Error("Failed to activate effect");
+    }
+    return await response.json();
+}
+
 export async function setRgb(red: number, green: number, blue: number): Promise<boolean> {
     const response = await fetch(`/api/setRgb.json?r=${red.toString()}&g=${green.toString()}&b=${blue.toString()}`);
     if (!response.ok) {